@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui network widgets qml
+QT       += core gui network widgets qml concurrent
 
 # QT += script - for old scriptsmanager
 
@@ -30,7 +30,7 @@ win32:RC_ICONS = main.ico
 mac:ICON = main.icns
 
 win32:LIBS += -luser32
-unix:!mac:LIBS += -lX11 -lXss
+unix:!mac:LIBS += -lX11 -lXss -lXi -lX11-xcb -lxcb
 
 INCLUDEPATH += ui data tools
 
@@ -39,6 +39,8 @@ SOURCES += \
     ui/settingswindow.cpp \
     tools/os_api.cpp \
     data/cdatamanager.cpp \
+    data/cdbjournal.cpp \
+    data/cstatisticengine.cpp \
     tools/cfilebin.cpp \
     ui/ctrayicon.cpp \
     ui/statisticwindow.cpp \
@@ -48,6 +50,7 @@ SOURCES += \
     ui/aboutwindow.cpp \
     data/cdbversionconverter.cpp \
     data/cscriptsmanager.cpp \
+    data/cactivityrules.cpp \
     ui/app_settingswindow.cpp \
     data/capppredefinedinfo.cpp \
     tools/tools.cpp \
@@ -62,6 +65,8 @@ HEADERS  += \
     ui/settingswindow.h \
     tools/os_api.h \
     data/cdatamanager.h \
+    data/cdbjournal.h \
+    data/cstatisticengine.h \
     tools/cfilebin.h \
     ui/ctrayicon.h \
     ui/statisticwindow.h \
@@ -71,6 +76,7 @@ HEADERS  += \
     ui/aboutwindow.h \
     data/cdbversionconverter.h \
     data/cscriptsmanager.h \
+    data/cactivityrules.h \
     ui/app_settingswindow.h \
     data/capppredefinedinfo.h \
     tools/tools.h \
@@ -0,0 +1,236 @@
+/*
+ * TrackYourTime - cross-platform time tracker
+ * Copyright (C) 2015-2017  Alexander Basov <basovav@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QSemaphore>
+#include <QTextStream>
+#include <QThread>
+#include "cstatisticengine.h"
+
+/*
+ * Aggregates synthetic 10-year database with shard pool limited to 1, 2, 4 and 8 threads.
+ * Every thread count is measured twice: cStatisticEngine::run over ready per day aggregates
+ * and full path, where per period scan(rebuildDays of every activity, done on db load and
+ * time zone change) is made before the run.
+ * Then rebuildDays alone is measured with day bounds cached between periods and computed
+ * again for every period.
+ * Build with qmake statisticbenchmark.pro, run without arguments.
+ */
+
+static const int    YEARS = 10;
+static const int    APPLICATIONS = 200;
+static const int    ACTIVITIES_PER_APP = 5;
+static const int    CATEGORIES = 8;
+static const int    PROFILES = 3;
+static const int    ACTIVE_DAYS_PERCENT = 30; //chance of activity to be used at some day
+static const int    RUNS = 10;
+
+//fixed seed, every run aggregates the same data
+static quint32 nextRandom(quint32& seed)
+{
+    seed = seed*1664525u+1013904223u;
+    return seed>>8;
+}
+
+static sStatisticQuery makeSyntheticQuery()
+{
+    const QDateTime now = QDateTime::currentDateTime();
+    const QDateTime first = now.addYears(-YEARS);
+    const int daysCount = first.daysTo(now);
+
+    sStatisticQuery query;
+    query.fromDay = first.date().toJulianDay();
+    query.toDay = now.date().toJulianDay();
+    query.categoriesCount = CATEGORIES;
+    query.applications.resize(APPLICATIONS);
+
+    quint32 seed = 12345;
+    sDayRange range;
+    for (int app = 0; app<APPLICATIONS; app++){
+        QVector<sActivityInfo>& activities = query.applications[app];
+        activities.resize(ACTIVITIES_PER_APP);
+        for (int activity = 0; activity<ACTIVITIES_PER_APP; activity++){
+            sActivityInfo& ainfo = activities[activity];
+            ainfo.name = QString("activity %1.%2").arg(app).arg(activity);
+            ainfo.nameUpcase = ainfo.name.toUpper();
+            ainfo.categories.resize(PROFILES);
+            for (int profile = 0; profile<PROFILES; profile++){
+                ainfo.categories[profile].category = (int)(nextRandom(seed)%(CATEGORIES+1))-1;
+                ainfo.categories[profile].visible = true;
+            }
+
+            for (int day = 0; day<daysCount; day++){
+                if ((int)(nextRandom(seed)%100)>=ACTIVE_DAYS_PERCENT)
+                    continue;
+                const quint32 dayStart = first.addDays(day).toSecsSinceEpoch();
+                const int periods = 1+nextRandom(seed)%4;
+                for (int i = 0; i<periods; i++){
+                    //some periods cross local midnight
+                    const quint32 start = dayStart+nextRandom(seed)%86400;
+                    const qint32 length = 1+nextRandom(seed)%3600;
+                    ainfo.periods.append(start,length,nextRandom(seed)%PROFILES);
+                }
+            }
+            ainfo.rebuildDays(range);
+        }
+    }
+    return query;
+}
+
+//per period scan, splits every period at local midnight
+static void rebuildAllDays(sStatisticQuery& query)
+{
+    sDayRange range;
+    for (int app = 0; app<query.applications.size(); app++){
+        QVector<sActivityInfo>& activities = query.applications[app];
+        for (int activity = 0; activity<activities.size(); activity++)
+            activities[activity].rebuildDays(range);
+    }
+}
+
+//day bounds computed for every period, as without sDayRange cache
+static void rebuildAllDaysUncached(sStatisticQuery& query)
+{
+    for (int app = 0; app<query.applications.size(); app++){
+        QVector<sActivityInfo>& activities = query.applications[app];
+        for (int activity = 0; activity<activities.size(); activity++){
+            sActivityInfo& ainfo = activities[activity];
+            ainfo.days.clear();
+            for (int i = 0; i<ainfo.periods.size(); i++){
+                sDayRange range;
+                ainfo.addToDays(ainfo.periods.start.at(i),ainfo.periods.length.at(i),ainfo.periods.profileIndex.at(i),range);
+            }
+        }
+    }
+}
+
+static QString formatTime(qint64 usecs)
+{
+    return QString::number(usecs/1000.0,'f',2)+" ms";
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QTextStream out(stdout);
+
+    QElapsedTimer timer;
+    timer.start();
+    sStatisticQuery query = makeSyntheticQuery();
+    out << "synthetic database: " << YEARS << " years, " << APPLICATIONS << " applications, "
+        << APPLICATIONS*ACTIVITIES_PER_APP << " activities, generated in " << timer.elapsed() << " ms\n";
+    out << "ideal thread count: " << QThread::idealThreadCount() << "\n";
+    out.flush();
+
+    cStatisticEngine engine;
+    QSemaphore done;
+    int totalTime = 0;
+    //pool thread emits finished, main thread only waits for it
+    QObject::connect(&engine,&cStatisticEngine::finished,[&done,&totalTime](int, sStatisticResult result){
+        totalTime = result.totalTime;
+        done.release();
+    });
+
+    const int threads[] = {1,2,4,8};
+    qint64 singleThreadTime = 0;
+    qint64 singleThreadFullTime = 0;
+    for (int threadsCount : threads){
+        engine.setMaxThreadCount(threadsCount);
+
+        //warm up, first query touches all data
+        engine.start(query);
+        done.acquire();
+
+        qint64 best = -1;
+        qint64 sum = 0;
+        qint64 bestFull = -1;
+        qint64 sumFull = 0;
+        qint64 sumScan = 0;
+        for (int i = 0; i<RUNS; i++){
+            timer.restart();
+            engine.start(query);
+            done.acquire();
+            const qint64 elapsed = timer.nsecsElapsed()/1000;
+            sum+=elapsed;
+            if (best<0 || elapsed<best)
+                best = elapsed;
+
+            timer.restart();
+            rebuildAllDays(query);
+            const qint64 scan = timer.nsecsElapsed()/1000;
+            engine.start(query);
+            done.acquire();
+            const qint64 elapsedFull = timer.nsecsElapsed()/1000;
+            sumScan+=scan;
+            sumFull+=elapsedFull;
+            if (bestFull<0 || elapsedFull<bestFull)
+                bestFull = elapsedFull;
+        }
+        if (threadsCount==1){
+            singleThreadTime = best;
+            singleThreadFullTime = bestFull;
+        }
+
+        out << "threads " << threadsCount
+            << ": run best " << formatTime(best)
+            << ", mean " << formatTime(sum/RUNS)
+            << ", speedup " << QString::number((double)singleThreadTime/qMax<qint64>(best,1),'f',2)
+            << "; scan+run best " << formatTime(bestFull)
+            << ", mean " << formatTime(sumFull/RUNS)
+            << " (scan mean " << formatTime(sumScan/RUNS) << ")"
+            << ", speedup " << QString::number((double)singleThreadFullTime/qMax<qint64>(bestFull,1),'f',2)
+            << ", total time " << totalTime << "\n";
+        out.flush();
+    }
+
+    struct sRebuildCase{
+        const char* name;
+        void (*rebuild)(sStatisticQuery&);
+    };
+    const sRebuildCase rebuildCases[] = {
+        {"rebuild, day bounds per period", rebuildAllDaysUncached},
+        {"rebuild, cached day bounds", rebuildAllDays}
+    };
+    qint64 uncachedTime = 0;
+    for (const sRebuildCase& rebuildCase : rebuildCases){
+        rebuildCase.rebuild(query);
+
+        qint64 best = -1;
+        qint64 sum = 0;
+        for (int i = 0; i<RUNS; i++){
+            timer.restart();
+            rebuildCase.rebuild(query);
+            const qint64 elapsed = timer.nsecsElapsed()/1000;
+            sum+=elapsed;
+            if (best<0 || elapsed<best)
+                best = elapsed;
+        }
+        if (uncachedTime==0)
+            uncachedTime = best;
+
+        out << rebuildCase.name
+            << ": best " << formatTime(best)
+            << ", mean " << formatTime(sum/RUNS)
+            << ", speedup " << QString::number((double)uncachedTime/qMax<qint64>(best,1),'f',2) << "\n";
+        out.flush();
+    }
+
+    return 0;
+}
@@ -0,0 +1,50 @@
+#-------------------------------------------------
+#
+# Statistic engine scaling benchmark, not a part of the application build
+#
+#-------------------------------------------------
+
+QT       += core gui network widgets qml concurrent
+
+TARGET = statisticbenchmark
+TEMPLATE = app
+CONFIG += console C++14
+CONFIG -= app_bundle
+
+QMAKE_CXXFLAGS += -DQT_COMPILING_QSTRING_COMPAT_CPP
+
+unix:!mac:QMAKE_CXXFLAGS += -std=c++14
+
+mac:LIBS += -framework CoreGraphics
+mac:LIBS += -framework AppKit
+win32:LIBS += -luser32
+unix:!mac:LIBS += -lX11 -lXss -lXi -lX11-xcb -lxcb
+
+INCLUDEPATH += ../data ../tools
+
+SOURCES += \
+    statisticbenchmark.cpp \
+    ../tools/os_api.cpp \
+    ../tools/cfilebin.cpp \
+    ../tools/tools.cpp \
+    ../data/cdatamanager.cpp \
+    ../data/cdbjournal.cpp \
+    ../data/cstatisticengine.cpp \
+    ../data/cexternaltrackers.cpp \
+    ../data/cdbversionconverter.cpp \
+    ../data/cscriptsmanager.cpp \
+    ../data/cactivityrules.cpp \
+    ../data/capppredefinedinfo.cpp
+
+HEADERS  += \
+    ../tools/os_api.h \
+    ../tools/cfilebin.h \
+    ../tools/tools.h \
+    ../data/cdatamanager.h \
+    ../data/cdbjournal.h \
+    ../data/cstatisticengine.h \
+    ../data/cexternaltrackers.h \
+    ../data/cdbversionconverter.h \
+    ../data/cscriptsmanager.h \
+    ../data/cactivityrules.h \
+    ../data/capppredefinedinfo.h
@@ -0,0 +1,203 @@
+/*
+ * TrackYourTime - cross-platform time tracker
+ * Copyright (C) 2015-2017  Alexander Basov <basovav@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cactivityrules.h"
+#include <QStringList>
+#include <QDebug>
+
+cActivityRules::cActivityRules()
+{
+}
+
+cActivityRules::cActivityRules(const QString &text)
+{
+    QStringList alternatives;
+    int groups = 0;
+    bool combinable = true;
+    const QStringList lines = text.split('\n');
+    for (int i = 0; i<lines.size(); i++){
+        const QString line = lines[i].trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        int separator = line.lastIndexOf("=>");
+        if (separator<0){
+            qCritical() << "activity rule " << i+1 << "has no \"=>\": " << line;
+            continue;
+        }
+        QString pattern = line.left(separator).trimmed();
+        if (pattern.startsWith("glob:"))
+            pattern = globToRegExp(pattern.mid(5).trimmed());
+
+        sActivityRule rule;
+        rule.pattern.setPattern(pattern);
+        rule.activityTemplate = line.mid(separator+2).trimmed();
+        if (!rule.pattern.isValid()){
+            qCritical() << "activity rule " << i+1 << "is incorrect: " << rule.pattern.errorString();
+            continue;
+        }
+        //numbers of groups are shifted in combined matcher
+        if (!isCombinable(pattern))
+            combinable = false;
+        rule.firstGroup = groups+1;
+        groups+=rule.pattern.captureCount()+1;
+        m_Rules.push_back(rule);
+        //lazy prefix makes first matched rule win, not the one matched at leftmost position
+        alternatives.push_back(".*?("+pattern+")");
+    }
+
+    if (m_Rules.isEmpty() || !combinable)
+        return;
+    m_Matcher.setPattern("^(?:"+alternatives.join('|')+")");
+    if (!m_Matcher.isValid()){
+        //same group names in different rules. rules are checked one by one
+        qDebug() << "activity rules can't be combined: " << m_Matcher.errorString();
+        m_Matcher = QRegularExpression();
+    }
+}
+
+QString cActivityRules::globToRegExp(const QString &glob)
+{
+    QString result = "^";
+    for (int i = 0; i<glob.size(); i++){
+        const QChar c = glob[i];
+        if (c=='*')
+            result+="(.*)";
+        else
+        if (c=='?')
+            result+="(.)";
+        else
+            result+=QRegularExpression::escape(QString(c));
+    }
+    return result+"$";
+}
+
+bool cActivityRules::isCombinable(const QString &pattern)
+{
+    const int size = pattern.size();
+    for (int i = 0; i<size; i++){
+        const QChar c = pattern[i];
+        if (c=='\\'){
+            if (i+1>=size)
+                break;
+            const QChar next = pattern[i+1];
+            //\Q...\E is literal text
+            if (next=='Q'){
+                int end = pattern.indexOf("\\E",i+2);
+                if (end<0)
+                    break;
+                i = end+1;
+                continue;
+            }
+            //\1-\9 back reference. \g1 \g{1} \g{-1} back reference, \g<1> \g'1' subroutine
+            if (next>='1' && next<='9')
+                return false;
+            if (next=='g' && i+2<size){
+                QChar reference = pattern[i+2];
+                if ((reference=='{' || reference=='<' || reference=='\'') && i+3<size)
+                    reference = pattern[i+3];
+                if (reference.isDigit() || reference=='-' || reference=='+')
+                    return false;
+            }
+            //any other escaped character, \\ is literal backslash
+            i++;
+            continue;
+        }
+        if (c=='['){
+            //class content is literal, ']' right after '[' or '[^' belongs to class
+            int j = i+1;
+            if (j<size && pattern[j]=='^')
+                j++;
+            if (j<size && pattern[j]==']')
+                j++;
+            while (j<size && pattern[j]!=']'){
+                if (pattern[j]=='\\')
+                    j++;
+                else
+                if (pattern[j]=='[' && j+1<size && pattern[j+1]==':'){
+                    int end = pattern.indexOf(":]",j+2);
+                    if (end>=0)
+                        j = end+1;
+                }
+                j++;
+            }
+            i = j;
+            continue;
+        }
+        if (c=='(' && i+2<size && pattern[i+1]=='?'){
+            const QChar kind = pattern[i+2];
+            const QChar after = i+3<size?pattern[i+3]:QChar();
+            //(?1) (?+1) (?-1) subroutines, (?R) recursion, (?&name) (?P>name) subroutines, (?| branch reset
+            if (kind.isDigit() || kind=='+' || kind=='R' || kind=='&' || kind=='|')
+                return false;
+            if ((kind=='-' && after.isDigit()) || (kind=='P' && after=='>'))
+                return false;
+            //(?(1)...) and (?(R)...) conditions
+            if (kind=='(' && (after.isDigit() || after=='+' || after=='-' || after=='R'))
+                return false;
+        }
+    }
+    return true;
+}
+
+QString cActivityRules::expand(const QString &activityTemplate, const QRegularExpressionMatch &match, int firstGroup)
+{
+    QString result;
+    result.reserve(activityTemplate.size()*2);
+    for (int i = 0; i<activityTemplate.size(); i++){
+        const QChar c = activityTemplate[i];
+        if (c=='$' && i+1<activityTemplate.size()){
+            const QChar next = activityTemplate[i+1];
+            if (next>='0' && next<='9'){
+                result+=match.captured(firstGroup+next.unicode()-'0');
+                i++;
+                continue;
+            }
+            if (next=='$'){
+                result+='$';
+                i++;
+                continue;
+            }
+        }
+        result+=c;
+    }
+    return result.trimmed();
+}
+
+bool cActivityRules::match(const QString &title, QString &activity) const
+{
+    if (m_Matcher.isValid() && !m_Matcher.pattern().isEmpty()){
+        QRegularExpressionMatch match = m_Matcher.match(title);
+        if (!match.hasMatch())
+            return false;
+        for (int i = 0; i<m_Rules.size(); i++){
+            if (match.capturedStart(m_Rules[i].firstGroup)!=-1){
+                activity = expand(m_Rules[i].activityTemplate,match,m_Rules[i].firstGroup);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    for (int i = 0; i<m_Rules.size(); i++){
+        QRegularExpressionMatch match = m_Rules[i].pattern.match(title);
+        if (match.hasMatch()){
+            activity = expand(m_Rules[i].activityTemplate,match,0);
+            return true;
+        }
+    }
+    return false;
+}
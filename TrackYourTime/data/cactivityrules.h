@@ -0,0 +1,60 @@
+/*
+ * TrackYourTime - cross-platform time tracker
+ * Copyright (C) 2015-2017  Alexander Basov <basovav@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CACTIVITYRULES_H
+#define CACTIVITYRULES_H
+
+#include <QString>
+#include <QVector>
+#include <QRegularExpression>
+
+/*
+ * Declarative title parser. One rule per line:
+ *   <regex> => <activity template>
+ *   glob:<wildcard> => <activity template>
+ * Template may use $0-$9 for captured text($0 - whole match), every * and ? of wildcard is captured.
+ * Rules are checked in order, first matched gives activity. Lines started with # are comments.
+ * Rules are combined into one expression, so the engine is called once per title. Title is still scanned by
+ * every rule before the matched one. Rules which refer to groups by number(back references, subroutines,
+ * recursion, numbered conditions) or reset group numbers can't be combined, then rules are checked one by one.
+ */
+struct sActivityRule{
+    QRegularExpression pattern;
+    QString activityTemplate;
+    int firstGroup; //group of rule in combined matcher, its own groups follow it
+};
+
+class cActivityRules
+{
+protected:
+    QVector<sActivityRule> m_Rules;
+    QRegularExpression  m_Matcher; //all rules in one alternation, empty if they can't be combined
+
+    static QString globToRegExp(const QString& glob);
+    //false if pattern depends on own group numbers or on being whole expression
+    static bool isCombinable(const QString& pattern);
+    static QString expand(const QString& activityTemplate, const QRegularExpressionMatch& match, int firstGroup);
+public:
+    cActivityRules();
+    explicit cActivityRules(const QString& text);
+
+    bool isEmpty() const {return m_Rules.isEmpty();}
+    //false if no rule matched title
+    bool match(const QString& title, QString& activity) const;
+};
+
+#endif // CACTIVITYRULES_H
@@ -18,6 +18,7 @@
 
 #include "cdatamanager.h"
 #include <QDebug>
+#include <QDateTime>
 #include <QFileInfo>
 #include <QDir>
 #include <QStandardPaths>
@@ -30,10 +31,13 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonArray>
+#include <QtConcurrent>
 
 const QString cDataManager::CONF_UPDATE_DELAY_ID = "UPDATE_DELAY";
 const QString cDataManager::CONF_IDLE_DELAY_ID = "IDLE_DELAY";
 const QString cDataManager::CONF_AUTOSAVE_DELAY_ID = "AUTOSAVE_DELAY";
+const QString cDataManager::CONF_SCRIPT_TIME_BUDGET_ID = "SCRIPT_TIME_BUDGET";
+const QString cDataManager::CONF_TRACKERS_BUFFER_ID = "TRACKERS_BUFFER";
 const QString cDataManager::CONF_STORAGE_FILENAME_ID = "STORAGE_FILENAME";
 const QString cDataManager::CONF_LANGUAGE_ID = "LANGUAGE";
 const QString cDataManager::CONF_FIRST_LAUNCH_ID = "FIRST_LAUNCH";
@@ -50,6 +54,7 @@ const QString cDataManager::CONF_NOTIFICATION_HIDE_BORDERS_ID = "NOTIFICATION_HI
 const QString cDataManager::CONF_AUTORUN_ID = "AUTORUN_ENABLED";
 const QString cDataManager::CONF_CLIENT_MODE_ID = "CLIENT_MODE";
 const QString cDataManager::CONF_CLIENT_MODE_HOST_ID = "CLIENT_MODE_HOST";
+const QString cDataManager::CONF_CLIENT_MODE_BINARY_ID = "CLIENT_MODE_BINARY";
 const QString cDataManager::CONF_LAST_AVAILABLE_VERSION_ID = "LAST_AVAILABLE_VERSION";
 const QString cDataManager::CONF_BACKUP_FILENAME_ID = "BACKUP_FILENAME";
 const QString cDataManager::CONF_BACKUP_DELAY_ID = "BACKUP_DELAY";
@@ -57,8 +62,14 @@ const QString cDataManager::CONF_BACKUP_DELAY_ID = "BACKUP_DELAY";
 
 cDataManager::cDataManager() :
   QObject(),
+  m_DataLock(QReadWriteLock::Recursive),
+  m_ExternalTrackers(NULL),
+  m_ScriptsManager(NULL),
+  m_MainTimer(this),
+  m_WindowWatcher(NULL),
+  m_ActiveWindowChanged(true),
+  m_CompactionWatcher(this),
   m_ShowSystemNotifications(false),
-  m_UpdateCounter(0),
   m_UpdateDelay(DEFAULT_SECONDS_UPDATE_DELAY),
   m_CurrentMousePos(QPoint(0,0)),
   m_CurrentApplicationIndex(-1),
@@ -69,6 +80,11 @@ cDataManager::cDataManager() :
   m_IdleDelay(DEFAULT_SECONDS_IDLE_DELAY),
   m_AutoSaveCounter(0),
   m_AutoSaveDelay(DEFAULT_SECONDS_AUTOSAVE_DELAY),
+  m_ScriptTimeBudget(DEFAULT_SCRIPT_TIME_BUDGET_MS),
+  m_LastSampleWallClock(0),
+  m_ElapsedRemainder(0),
+  m_PeriodOpened(false),
+  m_SampleInterval(DEFAULT_SECONDS_UPDATE_DELAY*1000),
   m_CurrentProfile(0)
 {
 #if (QT_VERSION < QT_VERSION_CHECK(5, 4, 0))
@@ -81,23 +97,55 @@ cDataManager::cDataManager() :
     loadPreferences();
     loadDB();
 
-    if (m_Profiles.empty()){
-        sProfile defaultProfile;
-        defaultProfile.name = tr("Default");
-        m_Profiles.push_back(defaultProfile);
-    }
+    qRegisterMetaType<sSysInfo>("sSysInfo");
+    qRegisterMetaType<sAppInfo::eTrackerType>("sAppInfo::eTrackerType");
 
+    QObject::connect(&m_CompactionWatcher, SIGNAL(finished()), this, SLOT(onCompactionFinished()));
     QObject::connect(&m_MainTimer, SIGNAL(timeout()), this, SLOT(process()));
-    m_MainTimer.start(1000);
+    m_MainTimer.setSingleShot(true);
+
+    moveToThread(&m_TrackingThread);
+    QObject::connect(&m_TrackingThread, SIGNAL(started()), this, SLOT(startTracking()));
+    QObject::connect(&m_TrackingThread, SIGNAL(finished()), this, SLOT(stopTracking()), Qt::DirectConnection);
+    m_TrackingThread.start();
 }
 
 cDataManager::~cDataManager()
 {    
-    saveDB();
+    m_TrackingThread.quit();
+    m_TrackingThread.wait();
     for (auto app: m_Applications)
         delete app;
 }
 
+void cDataManager::startTracking()
+{
+    m_ExternalTrackers = new cExternalTrackers(this);
+    m_ExternalTrackers->setReceiveBufferSize(m_TrackersBuffer*1024);
+    m_ScriptsManager = new cScriptsManager(this);
+    m_ScriptsManager->setTimeBudget(m_ScriptTimeBudget);
+    m_WindowWatcher = new cActiveWindowWatcher(this);
+    QObject::connect(m_WindowWatcher, SIGNAL(activeWindowChanged()), this, SLOT(onActiveWindowChanged()));
+    QObject::connect(m_WindowWatcher, SIGNAL(userInput()), this, SLOT(onUserInput()));
+    QObject::connect(m_ExternalTrackers, SIGNAL(trackersChanged()), this, SLOT(wakeUp()));
+    m_SampleTimer.start();
+    m_LastSampleWallClock = QDateTime::currentMSecsSinceEpoch();
+    scheduleSample(m_UpdateDelay*1000);
+}
+
+void cDataManager::stopTracking()
+{
+    //called in tracking thread after its event loop is finished
+    m_MainTimer.stop();
+    delete m_WindowWatcher;
+    m_WindowWatcher = NULL;
+    delete m_ScriptsManager;
+    m_ScriptsManager = NULL;
+    delete m_ExternalTrackers;
+    m_ExternalTrackers = NULL;
+    saveDB();
+}
+
 const sProfile *cDataManager::profiles(int index)
 {
     if (index<0 || index>=m_Profiles.size())
@@ -105,8 +153,48 @@ const sProfile *cDataManager::profiles(int index)
     return &m_Profiles[index];
 }
 
+void cDataManager::setCurrentProfileIndex(int ProfileIndex)
+{
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"setCurrentProfileIndex",Qt::BlockingQueuedConnection,Q_ARG(int,ProfileIndex));
+        return;
+    }
+    QWriteLocker locker(&m_DataLock);
+    m_CurrentProfile = ProfileIndex;
+    m_Journal.writeCurrentProfile(ProfileIndex);
+    emit profilesChanged();
+}
+
+void cDataManager::setCurrentProfileIndexSafe(int ProfileIndex)
+{
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"setCurrentProfileIndexSafe",Qt::QueuedConnection,Q_ARG(int,ProfileIndex));
+        return;
+    }
+    if (ProfileIndex<0 || ProfileIndex>=m_Profiles.size())
+        return;
+    setCurrentProfileIndex(ProfileIndex);
+}
+
+void cDataManager::setProfileName(int index, const QString &Name)
+{
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"setProfileName",Qt::BlockingQueuedConnection,Q_ARG(int,index),Q_ARG(QString,Name));
+        return;
+    }
+    QWriteLocker locker(&m_DataLock);
+    m_Profiles[index].name = Name;
+    m_Journal.writeProfile(index,Name);
+    emit profilesChanged();
+}
+
 void cDataManager::addNewProfile(const QString &Name, int CloneProfileIndex)
 {
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"addNewProfile",Qt::BlockingQueuedConnection,Q_ARG(QString,Name),Q_ARG(int,CloneProfileIndex));
+        return;
+    }
+    QWriteLocker locker(&m_DataLock);
     sProfile profile;
     profile.name = Name;
     m_Profiles.push_back(profile);
@@ -116,11 +204,17 @@ void cDataManager::addNewProfile(const QString &Name, int CloneProfileIndex)
         for (auto& act: app->activities) {
             act.categories.push_back(CloneProfileIndex == -1 ? def_state : act.categories[CloneProfileIndex]);
         }
+    saveDB(); //structural change - journal can't describe it
     emit profilesChanged();
 }
 
 void cDataManager::mergeProfiles(int profile1, int profile2)
 {
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"mergeProfiles",Qt::BlockingQueuedConnection,Q_ARG(int,profile1),Q_ARG(int,profile2));
+        return;
+    }
+    QWriteLocker locker(&m_DataLock);
     int profileToDelete = profile2;
     int profileToSave = profile1;
     if (profileToSave>profileToDelete){
@@ -132,29 +226,64 @@ void cDataManager::mergeProfiles(int profile1, int profile2)
     for (auto app: m_Applications)
         for (auto& act: app->activities) {
             act.categories.remove(profileToDelete);
-            for (auto& period: act.periods) {
-                if (period.profileIndex==profileToDelete) {
-                    period.profileIndex = profileToSave;
+            for (auto& profileIndex: act.periods.profileIndex) {
+                if (profileIndex==profileToDelete) {
+                    profileIndex = profileToSave;
                 }
                 else
-                if (period.profileIndex>profileToDelete) {
-                    period.profileIndex--;
+                if (profileIndex>profileToDelete) {
+                    profileIndex--;
                 }
             }
         }
     if (profileToDelete==m_CurrentProfile)
         m_CurrentProfile = profileToSave;
+    rebuildDays();
+    saveDB(); //structural change - journal can't describe it
     emit profilesChanged();
 }
 
+void cDataManager::setCategoryName(int index, const QString &Name)
+{
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"setCategoryName",Qt::BlockingQueuedConnection,Q_ARG(int,index),Q_ARG(QString,Name));
+        return;
+    }
+    QWriteLocker locker(&m_DataLock);
+    m_Categories[index].name = Name;
+    m_Journal.writeCategory(index,Name,m_Categories[index].color);
+}
+
+void cDataManager::setCategoryColor(int index, const QColor &color)
+{
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"setCategoryColor",Qt::BlockingQueuedConnection,Q_ARG(int,index),Q_ARG(QColor,color));
+        return;
+    }
+    QWriteLocker locker(&m_DataLock);
+    m_Categories[index].color = color;
+    m_Journal.writeCategory(index,m_Categories[index].name,color);
+}
+
 void cDataManager::addNewCategory(const QString &Name, QColor color)
 {
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"addNewCategory",Qt::BlockingQueuedConnection,Q_ARG(QString,Name),Q_ARG(QColor,color));
+        return;
+    }
+    QWriteLocker locker(&m_DataLock);
     const sCategory cat = {Name, color};
     m_Categories.push_back(cat);
+    m_Journal.writeCategory(m_Categories.size()-1,Name,color);
 }
 
 void cDataManager::deleteCategory(int index)
 {
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"deleteCategory",Qt::BlockingQueuedConnection,Q_ARG(int,index));
+        return;
+    }
+    QWriteLocker locker(&m_DataLock);
     for (auto app: m_Applications) {
         for (auto& act: app->activities) {
             for (auto& cat: act.categories) {
@@ -167,23 +296,81 @@ void cDataManager::deleteCategory(int index)
         }
     }
     m_Categories.remove(index);
+    saveDB(); //structural change - journal can't describe it
     emit applicationsChanged();
 }
 
 void cDataManager::setApplicationActivityCategory(int profile, int appIndex, int activityIndex, int category)
 {
-    if (profile==-1) {
-        for (auto& cat: m_Applications[appIndex]->activities[activityIndex].categories)
-            cat.category = category;
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"setApplicationActivityCategory",Qt::BlockingQueuedConnection,Q_ARG(int,profile),Q_ARG(int,appIndex),Q_ARG(int,activityIndex),Q_ARG(int,category));
+        return;
     }
-    else {
-        m_Applications[appIndex]->activities[activityIndex].categories[profile].category = category;
+    QWriteLocker locker(&m_DataLock);
+    sActivityInfo& activity = m_Applications[appIndex]->activities[activityIndex];
+    for (int i = 0; i<activity.categories.size(); i++){
+        if (profile==-1 || profile==i){
+            activity.categories[i].category = category;
+            m_Journal.writeActivityState(appIndex,activityIndex,i,category,activity.categories[i].visible);
+        }
     }
+}
 
+void cDataManager::setApplicationActivityVisible(int profile, int appIndex, int activityIndex, bool visible)
+{
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"setApplicationActivityVisible",Qt::BlockingQueuedConnection,Q_ARG(int,profile),Q_ARG(int,appIndex),Q_ARG(int,activityIndex),Q_ARG(bool,visible));
+        return;
+    }
+    QWriteLocker locker(&m_DataLock);
+    sActivityProfileState& state = m_Applications[appIndex]->activities[activityIndex].categories[profile];
+    state.visible = visible;
+    m_Journal.writeActivityState(appIndex,activityIndex,profile,state.category,visible);
+}
+
+void cDataManager::setApplicationSettings(int appIndex, sAppInfo::eTrackerType trackerType, bool useCustomScript, const QString &customScript, const QString &rules)
+{
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"setApplicationSettings",Qt::BlockingQueuedConnection,Q_ARG(int,appIndex),Q_ARG(sAppInfo::eTrackerType,trackerType),Q_ARG(bool,useCustomScript),Q_ARG(QString,customScript),Q_ARG(QString,rules));
+        return;
+    }
+    QWriteLocker locker(&m_DataLock);
+    sAppInfo* app = m_Applications[appIndex];
+    if (app->customScript!=customScript)
+        m_ScriptsManager->releaseScript(app->customScript);
+    if (app->rules!=rules)
+        m_CompiledRules.remove(app->rules);
+    app->trackerType = trackerType;
+    app->useCustomScript = useCustomScript;
+    app->customScript = customScript;
+    app->rules = rules;
+    m_Journal.writeApplicationSettings(appIndex,app->visible,app->trackerType,app->useCustomScript,app->customScript,app->rules);
+}
+
+QString cDataManager::getStorageFileName()
+{
+    QReadLocker locker(&m_DataLock);
+    return m_StorageFileName;
+}
+
+void cDataManager::setDebugScript(const QString &script)
+{
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"setDebugScript",Qt::QueuedConnection,Q_ARG(QString,script));
+        return;
+    }
+    if (m_DebugScript!=script)
+        m_ScriptsManager->releaseScript(m_DebugScript);
+    m_DebugScript = script;
 }
 
 void cDataManager::makeBackup()
 {
+    //nobody waits for backup, it's only queued
+    if (!isTrackingThread()){
+        QMetaObject::invokeMethod(this,"makeBackup",Qt::QueuedConnection);
+        return;
+    }
     int delayDays = -1;
     switch(m_BackupDelay){
         case BD_ONE_DAY:{
@@ -208,6 +395,9 @@ void cDataManager::makeBackup()
         break;
     }
 
+    //fold journal into snapshot, otherwise backup will miss everything since last compaction
+    saveDB();
+
     QDateTime now = QDateTime::currentDateTime();
     if (delayDays>-1){
         const QDir backFolder = m_BackupFolder;
@@ -226,14 +416,101 @@ void cDataManager::makeBackup()
 
 void cDataManager::process()
 {
-    m_ExternalTrackers.update();
+    bool changed = sample();
+    scheduleSample(nextSampleInterval(changed));
+}
 
-    m_UpdateCounter++;
-    if (m_UpdateCounter<m_UpdateDelay)
-        return;
-    m_UpdateCounter = 0;
+void cDataManager::scheduleSample(int interval)
+{
+    //accounting doesn't depend on timer precision, so long waits can be coalesced by system
+    m_MainTimer.setTimerType(interval>m_UpdateDelay*1000?Qt::CoarseTimer:Qt::PreciseTimer);
+    m_MainTimer.start(interval);
+    m_ScheduledInterval = interval;
+}
+
+int cDataManager::nextSampleInterval(bool changed)
+{
+    int interval = m_UpdateDelay*1000;
+    if (m_Idle){
+        //nothing is tracked while idle. without input notifications return is caught by polling
+        if (m_WindowWatcher->canWatchUserInput())
+            return qMax(interval,IDLE_SAMPLE_INTERVAL_MS);
+        return qMax(interval,IDLE_POLL_INTERVAL_MS);
+    }
+
+    //focus and title changes are delivered by watcher, so stable window may be sampled rarely
+    if (changed || !m_WindowWatcher->isActive())
+        m_SampleInterval = interval;
+    else
+        m_SampleInterval = qMin(m_SampleInterval*2,qMax(interval,STABLE_SAMPLE_INTERVAL_MS));
+
+    //override records expire, they are checked here in time
+    if (m_ExternalTrackers->hasOverrideTrackers())
+        return qMin(m_SampleInterval,qMax(interval,cExternalTrackers::OVERRIDE_TRACKERS_PAIR_LIFE_TIME_SECOND*1000/2));
+    //client reports when its idle time on host drifts too far, text packets expire on host much earlier
+    if (m_ClientMode && !m_ClientModeBinary)
+        return qMin(m_SampleInterval,qMax(interval,cExternalTrackers::CLIENT_TEXT_HEARTBEAT_SECOND*1000));
+    if (m_ClientMode)
+        return qMin(m_SampleInterval,qMax(interval,cExternalTrackers::CLIENT_IDLE_TOLERANCE_SECOND*1000/2));
+    return m_SampleInterval;
+}
+
+void cDataManager::wakeUp()
+{
+    m_SampleInterval = m_UpdateDelay*1000;
+    //burst of notifications gives one sample
+    if (!m_MainTimer.isActive() || m_MainTimer.remainingTime()>WAKEUP_COALESCE_MS){
+        m_MainTimer.setTimerType(Qt::PreciseTimer);
+        m_MainTimer.start(WAKEUP_COALESCE_MS);
+    }
+}
+
+int cDataManager::takeElapsedSeconds(bool& suspended)
+{
+    qint64 elapsed = m_SampleTimer.restart();
+    qint64 wallClock = QDateTime::currentMSecsSinceEpoch();
+    qint64 wallElapsed = wallClock-m_LastSampleWallClock;
+    m_LastSampleWallClock = wallClock;
+
+    //monotonic clock stops while system sleeps on some platforms, wall clock continues.
+    //on others monotonic clock continues, but so long gap between samples can't be tracked time.
+    //idle samples are rare by design, gap is counted only beyond the wait that was scheduled
+    const qint64 maxGap = qMax<qint64>((qint64)m_IdleDelay*1000,m_ScheduledInterval)+SUSPEND_DETECT_MS;
+    const bool longGap = elapsed>maxGap;
+    suspended = wallElapsed-elapsed>SUSPEND_DETECT_MS || longGap;
+    if (suspended){
+        qDebug() << "cDataManager: sampling gap " << qMax(wallElapsed,elapsed)/1000 << " seconds, treated as suspend";
+        if (longGap)
+            elapsed = 0;
+    }
+
+    //periods are stored in seconds, remainder goes to next sample
+    m_ElapsedRemainder+=elapsed;
+    int seconds = m_ElapsedRemainder/1000;
+    m_ElapsedRemainder%=1000;
+    return seconds;
+}
+
+void cDataManager::addCurrentActivityTime(int seconds)
+{
+    sActivityInfo& activity = m_Applications[m_CurrentApplicationIndex]->activities[m_CurrentApplicationActivityIndex];
+    activity.incTime(seconds,m_DayRange);
+    m_Journal.writePeriod(m_CurrentApplicationIndex,m_CurrentApplicationActivityIndex,activity.periods.size()-1,activity.periods.start.last(),activity.periods.length.last(),activity.periods.profileIndex.last(),false);
+    int category = activity.categories[m_CurrentProfile].category;
+    m_StatisticSequence++;
+    emit statisticFastUpdate(m_CurrentApplicationIndex, m_CurrentApplicationActivityIndex, category, seconds, false, m_StatisticSequence);
+}
+
+bool cDataManager::sample()
+{
+    m_ExternalTrackers->update();
+
+    //real time since previous sample, timer precision and event loop stalls don't affect it
+    bool suspended = false;
+    int elapsed = takeElapsedSeconds(suspended);
 
-    bool isUserActive = getIdleTime()==0;
+    int idleTime = getIdleTime();
+    bool isUserActive = idleTime>=0 && idleTime<qMax(1,elapsed);
 
     //Update keyboard activity
     //if (isKeyboardChanged()){
@@ -250,15 +527,27 @@ void cDataManager::process()
     if (isUserActive)
         m_LastLocalActivity = 0;
     else
-        m_LastLocalActivity+=m_UpdateDelay;
+        m_LastLocalActivity = idleTime>=0?idleTime:m_LastLocalActivity+elapsed; //samples may be rare, system idle time is exact
     int hostActivity = m_LastLocalActivity+1;
-    sOverrideTrackerInfo* info = m_ExternalTrackers.getOverrideTracker();
+    sOverrideTrackerInfo* info = m_ExternalTrackers->getOverrideTracker();
     if (info)
         hostActivity = info->IdleTime-2;
 
-    //Update application
+    //Update application. when watcher is active application is probed only on focus or title change
     bool isAppChanged = false;
-    sSysInfo currentAppInfo = getCurrentApplication();
+    if (m_ActiveWindowChanged || !m_WindowWatcher->isActive()){
+        m_ActiveWindowInfo = getCurrentApplication();
+        m_ActiveWindowChanged = false;
+    }
+    const sSysInfo& currentAppInfo = m_ActiveWindowInfo;
+
+    //system is probed, everything below changes model
+    QWriteLocker locker(&m_DataLock);
+
+    //time since previous sample belongs to activity which was active at that sample
+    if (m_CurrentApplicationIndex>-1 && m_PeriodOpened && !m_Idle && elapsed>0)
+        addCurrentActivityTime(elapsed);
+
     int appIndex = getAppIndex(currentAppInfo);
     int activityIndex = appIndex>-1?getActivityIndex(appIndex,currentAppInfo):0;
 
@@ -277,7 +566,8 @@ void cDataManager::process()
         m_CurrentApplicationIndex = appIndex;
         m_CurrentApplicationActivityIndex = activityIndex;
         if (m_CurrentApplicationIndex>-1){
-            m_Applications[m_CurrentApplicationIndex]->activities[m_CurrentApplicationActivityIndex].categories[m_CurrentProfile].visible = true;
+            if (!m_Applications[m_CurrentApplicationIndex]->activities[m_CurrentApplicationActivityIndex].categories[m_CurrentProfile].visible)
+                setApplicationActivityVisible(m_CurrentProfile,m_CurrentApplicationIndex,m_CurrentApplicationActivityIndex,true);
             int activityCategory = m_Applications[m_CurrentApplicationIndex]->activities[m_CurrentApplicationActivityIndex].categories[m_CurrentProfile].category;
 
             if (m_ShowSystemNotifications)
@@ -293,10 +583,14 @@ void cDataManager::process()
     }
     emit showNotification();
 
-    if (m_CurrentApplicationIndex>-1 && (!m_Idle || isAppChanged)){
-        m_Applications[m_CurrentApplicationIndex]->activities[m_CurrentApplicationActivityIndex].incTime(isAppChanged,m_CurrentProfile,m_UpdateDelay);
-        int category = m_Applications[m_CurrentApplicationIndex]->activities[m_CurrentApplicationActivityIndex].categories[m_CurrentProfile].category;
-        emit statisticFastUpdate(m_CurrentApplicationIndex, m_CurrentApplicationActivityIndex, category, m_UpdateDelay, false);
+    //new period starts now on switch, after idle or suspend. timeline of periods follows wall clock
+    if (isAppChanged || (m_Idle && isUserActive) || suspended)
+        m_PeriodOpened = false;
+    if (m_CurrentApplicationIndex>-1 && !m_PeriodOpened && (isUserActive || !m_Idle)){
+        sActivityInfo& activity = m_Applications[m_CurrentApplicationIndex]->activities[m_CurrentApplicationActivityIndex];
+        activity.startPeriod(m_CurrentProfile);
+        m_Journal.writePeriod(m_CurrentApplicationIndex,m_CurrentApplicationActivityIndex,activity.periods.size()-1,activity.periods.start.last(),0,m_CurrentProfile,true);
+        m_PeriodOpened = true;
     }
 
     if (isUserActive){
@@ -304,66 +598,141 @@ void cDataManager::process()
         if (m_Idle){
             emit trayActive();
             m_Idle = false;
+            m_WindowWatcher->watchUserInput(false);
         }
     }
     else{
-        m_IdleCounter+=m_UpdateDelay;
+        m_IdleCounter = idleTime>=0?idleTime:m_IdleCounter+elapsed;
         if (m_IdleCounter>m_IdleDelay && !m_Idle){
             emit traySleep();
             m_Idle = true;
-            if (m_CurrentApplicationIndex>-1){
-                m_Applications[m_CurrentApplicationIndex]->activities[m_CurrentApplicationActivityIndex].periods.last().length-=m_IdleCounter;
+            m_WindowWatcher->watchUserInput(true);
+            if (m_CurrentApplicationIndex>-1 && m_PeriodOpened){
+                sActivityInfo& activity = m_Applications[m_CurrentApplicationIndex]->activities[m_CurrentApplicationActivityIndex];
+                activity.cutLastPeriod(m_IdleCounter,m_DayRange);
+                const sTimePeriods& periods = activity.periods;
+                m_Journal.writePeriod(m_CurrentApplicationIndex,m_CurrentApplicationActivityIndex,periods.size()-1,periods.start.last(),periods.length.last(),periods.profileIndex.last(),true);
             }
-            //force autosave
-            m_AutoSaveCounter=m_AutoSaveDelay;
         }
     }
 
     if (!m_Idle)
-        m_AutoSaveCounter+=m_UpdateDelay;
+        m_AutoSaveCounter+=elapsed;
 
-    if (m_AutoSaveCounter>=m_AutoSaveDelay){
+    m_Journal.flush();
+    if (m_AutoSaveCounter>=m_AutoSaveDelay || m_Journal.size()>JOURNAL_COMPACTION_SIZE){
         m_AutoSaveCounter = 0;
-        saveDB();
+        compactDB();
     }
 
     if (!m_Idle && m_ClientMode){
-      const int idleTime = m_IdleCounter == m_UpdateDelay ? 0 : m_IdleCounter;
       if (m_CurrentApplicationIndex > -1) {
-            m_ExternalTrackers.sendOverrideTracker(
+            m_ExternalTrackers->sendOverrideTracker(
                 m_Applications[m_CurrentApplicationIndex]->activities[0].name,
                 m_Applications[m_CurrentApplicationIndex]->activities[m_CurrentApplicationActivityIndex].name,
-                idleTime, m_ClientModeHost);
+                m_IdleCounter, m_ClientModeHost, m_ClientModeBinary);
         }
         else{
-            m_ExternalTrackers.sendOverrideTracker("", "", idleTime, m_ClientModeHost);
+            m_ExternalTrackers->sendOverrideTracker("", "", m_IdleCounter, m_ClientModeHost, m_ClientModeBinary);
         }
     }
+    return isAppChanged || suspended;
+}
+
+void cDataManager::onActiveWindowChanged()
+{
+    //previous window gets time up to this moment, not up to next tick
+    m_ActiveWindowChanged = true;
+    wakeUp();
+}
+
+void cDataManager::onUserInput()
+{
+    //one event is enough, stream of them is not needed until next idle
+    m_WindowWatcher->watchUserInput(false);
+    wakeUp();
 }
 
 void cDataManager::onPreferencesChanged()
 {
+    QWriteLocker locker(&m_DataLock);
     saveDB(); //save to old storage
     loadPreferences(); //read new preferences
     loadDB();//reload current storage or load new if STORAGE_FILENAME changed
+    m_ScriptsManager->clearCompiledScripts();
+    m_CompiledRules.clear();
+    m_ScriptsManager->setTimeBudget(m_ScriptTimeBudget);
+    m_ExternalTrackers->setReceiveBufferSize(m_TrackersBuffer*1024);
+    //indexes may point to other storage, tracking starts again
+    m_CurrentApplicationIndex = -1;
+    m_PeriodOpened = false;
     emit profilesChanged();
 }
 
 
+sActivityInfo createActivity(const QString& activityName, int profilesCount)
+{
+    sActivityInfo ainfo;
+    ainfo.name = activityName;
+    ainfo.nameUpcase = activityName.toUpper();
+    ainfo.categories.resize(profilesCount);
+    for (int i = 0; i<ainfo.categories.size(); i++){
+        ainfo.categories[i].category = -1;
+        ainfo.categories[i].visible = false;
+    }
+    return ainfo;
+}
+
+//names are case insensitive. index holds upcase names and also every spelling already seen, so usual lookup does not call toUpper()
+int findInIndex(QHash<QString,int>& index, const QString& name)
+{
+    QHash<QString,int>::const_iterator it = index.constFind(name);
+    if (it!=index.constEnd())
+        return it.value();
+    it = index.constFind(name.toUpper());
+    if (it==index.constEnd())
+        return -1;
+    int value = it.value();
+    index.insert(name,value);
+    return value;
+}
+
+void cDataManager::rebuildIndex()
+{
+    m_ApplicationsIndex.clear();
+    for (int i = 0; i<m_Applications.size(); i++){
+        if (!m_ApplicationsIndex.contains(m_Applications[i]->activities[0].nameUpcase))
+            m_ApplicationsIndex.insert(m_Applications[i]->activities[0].nameUpcase,i);
+        QHash<QString,int>& activitiesIndex = m_Applications[i]->activitiesIndex;
+        activitiesIndex.clear();
+        for (int j = 0; j<m_Applications[i]->activities.size(); j++)
+            if (!activitiesIndex.contains(m_Applications[i]->activities[j].nameUpcase))
+                activitiesIndex.insert(m_Applications[i]->activities[j].nameUpcase,j);
+    }
+}
+
+void cDataManager::rebuildDays()
+{
+    m_DayRange = sDayRange(); //time zone may be changed since last rebuild
+    sDayRange range;
+    for (int i = 0; i<m_Applications.size(); i++)
+        for (int j = 0; j<m_Applications[i]->activities.size(); j++)
+            m_Applications[i]->activities[j].rebuildDays(range);
+}
+
 int cDataManager::getAppIndex(const sSysInfo &FileInfo)
 {
     if (FileInfo.fileName.isEmpty())
         return -1;
 
-    QString upcaseFileName = FileInfo.fileName.toUpper();
-    for (int i = 0; i<m_Applications.size(); i++){
-        if (m_Applications[i]->activities[0].nameUpcase==upcaseFileName){
-            if (m_Applications[i]->path.isEmpty() && !FileInfo.path.isEmpty()){
-                m_Applications[i]->path = FileInfo.path;
-                emit applicationsChanged();
-            }
-            return i;
+    int index = findInIndex(m_ApplicationsIndex,FileInfo.fileName);
+    if (index>-1){
+        if (m_Applications[index]->path.isEmpty() && !FileInfo.path.isEmpty()){
+            m_Applications[index]->path = FileInfo.path;
+            m_Journal.writeApplication(index,m_Applications[index]->activities[0].name,FileInfo.path);
+            emit applicationsChanged();
         }
+        return index;
     }
 
     //app not exists in our list(first launch) - add to list
@@ -371,9 +740,13 @@ int cDataManager::getAppIndex(const sSysInfo &FileInfo)
     info->path = FileInfo.path;
 
     m_Applications.push_back(info);
+    index = m_Applications.size()-1;
+    m_ApplicationsIndex.insert(info->activities[0].nameUpcase,index);
+    m_ApplicationsIndex.insert(FileInfo.fileName,index);
+    m_Journal.writeApplication(index,FileInfo.fileName,FileInfo.path);
     emit applicationsChanged();
 
-    return m_Applications.size()-1;
+    return index;
 }
 
 int cDataManager::getActivityIndex(int appIndex,const sSysInfo &FileInfo)
@@ -382,203 +755,611 @@ int cDataManager::getActivityIndex(int appIndex,const sSysInfo &FileInfo)
 
     QString activity;
 
+    //matched rule gives final activity, scripts are not run
+    bool ruleMatched = !appInfo->rules.isEmpty() && compiledRules(appInfo->rules).match(FileInfo.title,activity);
+
+    if (!ruleMatched)
     switch(appInfo->trackerType){
         case sAppInfo::eTrackerType::TT_EXECUTABLE_DETECTOR:
         case sAppInfo::eTrackerType::TT_EXTERNAL_DETECTOR:{
-            if (!m_ExternalTrackers.getExternalTrackerState(appInfo->activities[0].nameUpcase,activity))
+            if (!m_ExternalTrackers->getExternalTrackerState(appInfo->activities[0].nameUpcase,activity))
                 activity="";
         };
             break;
         case sAppInfo::eTrackerType::TT_PREDEFINED_SCRIPT:{
-            activity = m_ScriptsManager.getAppInfo(FileInfo,appInfo->predefinedInfo->script());
+            activity = m_ScriptsManager->getAppInfo(FileInfo,appInfo->predefinedInfo->script());
+            if (m_ScriptsManager->isCallInterrupted())
+                return previousActivityIndex(appIndex);
         };
             break;        
     }
 
     if (!m_DebugScript.isEmpty()){
-        emit debugScriptResult(m_ScriptsManager.evaluteCustomScript(FileInfo,m_DebugScript,activity).toString(),FileInfo,activity);
+        emit debugScriptResult(m_ScriptsManager->evaluteCustomScript(FileInfo,m_DebugScript,activity).toString(),FileInfo,activity);
     }
 
-    if (appInfo->useCustomScript)
-        activity = m_ScriptsManager.processCustomScript(FileInfo,appInfo->customScript,activity);
+    if (appInfo->useCustomScript && !ruleMatched){
+        activity = m_ScriptsManager->processCustomScript(FileInfo,appInfo->customScript,activity);
+        if (m_ScriptsManager->isCallInterrupted())
+            return previousActivityIndex(appIndex);
+    }
 
     return getActivityIndexDirect(appIndex,activity);
 }
 
+const cActivityRules &cDataManager::compiledRules(const QString &rules)
+{
+    QHash<QString,cActivityRules>::const_iterator it = m_CompiledRules.constFind(rules);
+    if (it!=m_CompiledRules.constEnd())
+        return it.value();
+    if (m_CompiledRules.size()>=MAX_COMPILED_RULES)
+        m_CompiledRules.clear();
+    return m_CompiledRules.insert(rules,cActivityRules(rules)).value();
+}
+
+int cDataManager::previousActivityIndex(int appIndex)
+{
+    //script was stopped, activity is not known. time goes to the one tracked before
+    return appIndex==m_CurrentApplicationIndex?m_CurrentApplicationActivityIndex:0;
+}
+
 int cDataManager::getActivityIndexDirect(int appIndex, QString activityName)
 {
     if (activityName.isEmpty())
         return 0;
 
-    QString activityNameUpcase = activityName.toUpper();
+    sAppInfo* appInfo = m_Applications[appIndex];
+    int index = findInIndex(appInfo->activitiesIndex,activityName);
+    if (index>-1)
+        return index;
+
+    appInfo->activities.push_back(createActivity(activityName,m_Profiles.size()));
+    index = appInfo->activities.size()-1;
+    appInfo->activitiesIndex.insert(appInfo->activities[index].nameUpcase,index);
+    appInfo->activitiesIndex.insert(activityName,index);
+    m_Journal.writeActivity(appIndex,index,activityName);
+    emit applicationsChanged();
+    return index;
+}
 
-    for (int i = 0; i<m_Applications[appIndex]->activities.size(); i++){
-        if (m_Applications[appIndex]->activities[i].nameUpcase==activityNameUpcase){
-            return i;
-        }
-    }
+const int FILE_FORMAT_VERSION = 6;
+const int FILE_FORMAT_BASE_VERSION = 5; //read by readDB, older versions are decoded by readOldDB
+const int FILE_FORMAT_RULES_VERSION = 6; //first version with activity rules
 
-    sActivityInfo ainfo;
-    ainfo.name = activityName;
-    ainfo.nameUpcase = activityNameUpcase;
-    ainfo.categories.resize(m_Profiles.size());
-    for (int i = 0; i<ainfo.categories.size(); i++){
-        ainfo.categories[i].category = -1;
-        ainfo.categories[i].visible = false;
+sDBSnapshot cDataManager::makeSnapshot()
+{
+    sDBSnapshot snapshot;
+    snapshot.profiles = m_Profiles;
+    snapshot.currentProfile = m_CurrentProfile;
+    snapshot.categories = m_Categories;
+    snapshot.applications.resize(m_Applications.size());
+    for (int i = 0; i<m_Applications.size(); i++){
+        snapshot.applications[i].visible = m_Applications[i]->visible;
+        snapshot.applications[i].path = m_Applications[i]->path;
+        snapshot.applications[i].trackerType = m_Applications[i]->trackerType;
+        snapshot.applications[i].useCustomScript = m_Applications[i]->useCustomScript;
+        snapshot.applications[i].customScript = m_Applications[i]->customScript;
+        snapshot.applications[i].rules = m_Applications[i]->rules;
+        snapshot.applications[i].activities = m_Applications[i]->activities;
     }
-    m_Applications[appIndex]->activities.push_back(ainfo);
-    emit applicationsChanged();
-    return m_Applications[appIndex]->activities.size()-1;
+    return snapshot;
 }
 
-const int FILE_FORMAT_VERSION = 4;
+//index of string in file string table, every string is stored once
+static quint32 stringIndex(QHash<QString,quint32>& index, QVector<QString>& strings, const QString& value)
+{
+    QHash<QString,quint32>::const_iterator it = index.constFind(value);
+    if (it!=index.constEnd())
+        return it.value();
+    quint32 result = strings.size();
+    strings.push_back(value);
+    index.insert(value,result);
+    return result;
+}
 
-void cDataManager::saveDB()
+bool cDataManager::writeDB(const sDBSnapshot &snapshot, const QString &FileName)
 {
-    if (m_StorageFileName.isEmpty())
-        return;
-    cFileBin file( m_StorageFileName+".new" );
-    if ( file.open(QIODevice::WriteOnly) )
-    {
-        //header
-        file.write(FILE_FORMAT_PREFIX,FILE_FORMAT_PREFIX_SIZE);
-        file.writeInt(FILE_FORMAT_VERSION);
-
-        //profiles
-        file.writeInt(m_Profiles.size());
-        for (int i = 0; i<m_Profiles.size(); i++){
-            file.writeString(m_Profiles[i].name);
-        }
-        file.writeInt(m_CurrentProfile);
-
-        //categories
-        file.writeInt(m_Categories.size());
-        for (int i = 0; i<m_Categories.size(); i++){
-            file.writeString(m_Categories[i].name);
-            file.writeUint(m_Categories[i].color.rgba());
-        }
-
-        //applications
-        file.writeInt(m_Applications.size());
-        for (int i = 0; i<m_Applications.size(); i++){
-            file.writeInt(m_Applications[i]->visible?1:0);
-            file.writeString(m_Applications[i]->path);
-            file.writeInt(m_Applications[i]->trackerType);
-            file.writeInt(m_Applications[i]->useCustomScript?1:0);
-            file.writeString(m_Applications[i]->customScript);
-
-            file.writeInt(m_Applications[i]->activities.size());
-            for (int activity = 0; activity<m_Applications[i]->activities.size(); activity++){
-                sActivityInfo* info = &m_Applications[i]->activities[activity];                
-                file.writeString(info->name);
-
-                //app category for every profile
-                file.writeInt(info->categories.size());
-                for (int j = 0; j<info->categories.size(); j++){
-                    file.writeInt(info->categories[j].category);
-                    file.writeInt(info->categories[j].visible?1:0);
-                }
+    cFileBin file( FileName+".new" );
+    if ( !file.open(QIODevice::WriteOnly) )
+        return false;
 
-                //total use time
-                file.writeInt(info->periods.size());
-                for (int j = 0; j<info->periods.size(); j++){
-                    file.writeUint(info->periods[j].start.toTime_t());
-                    file.writeInt(info->periods[j].length);
-                    file.writeInt(info->periods[j].profileIndex);
-                }
+    //body is built first - string table must be written before it
+    QHash<QString,quint32> stringsIndex;
+    QVector<QString> strings;
+    cByteBin body;
+
+    //profiles
+    body.writeVarUint(snapshot.profiles.size());
+    for (int i = 0; i<snapshot.profiles.size(); i++){
+        body.writeVarUint(stringIndex(stringsIndex,strings,snapshot.profiles[i].name));
+    }
+    body.writeVarInt(snapshot.currentProfile);
+
+    //categories
+    body.writeVarUint(snapshot.categories.size());
+    for (int i = 0; i<snapshot.categories.size(); i++){
+        body.writeVarUint(stringIndex(stringsIndex,strings,snapshot.categories[i].name));
+        body.writeUint(snapshot.categories[i].color.rgba());
+    }
+
+    //applications
+    body.writeVarUint(snapshot.applications.size());
+    for (int i = 0; i<snapshot.applications.size(); i++){
+        const sAppSnapshot& app = snapshot.applications[i];
+        body.writeVarUint((app.visible?1:0) | (app.useCustomScript?2:0));
+        body.writeVarUint(app.trackerType);
+        body.writeVarUint(stringIndex(stringsIndex,strings,app.path));
+        body.writeVarUint(stringIndex(stringsIndex,strings,app.customScript));
+        body.writeVarUint(stringIndex(stringsIndex,strings,app.rules));
+
+        body.writeVarUint(app.activities.size());
+        for (int activity = 0; activity<app.activities.size(); activity++){
+            const sActivityInfo* info = &app.activities[activity];
+            body.writeVarUint(stringIndex(stringsIndex,strings,info->name));
+
+            //app category for every profile. zigzag category and visible flag in one value
+            body.writeVarUint(info->categories.size());
+            for (int j = 0; j<info->categories.size(); j++){
+                body.writeVarUint((cByteBin::zigzag(info->categories[j].category)<<1) | (info->categories[j].visible?1:0));
+            }
+
+            //total use time. start is stored as distance from end of previous period
+            const int periodsCount = info->periods.size();
+            const quint32* start = info->periods.start.constData();
+            const qint32* length = info->periods.length.constData();
+            const quint16* profileIndex = info->periods.profileIndex.constData();
+            body.writeVarUint(periodsCount);
+            qint64 prevEnd = 0;
+            for (int j = 0; j<periodsCount; j++){
+                body.writeVarInt(static_cast<qint64>(start[j])-prevEnd);
+                body.writeVarUint(static_cast<quint32>(length[j]));
+                body.writeVarUint(profileIndex[j]);
+                prevEnd = static_cast<qint64>(start[j])+length[j];
             }
         }
-        file.close();
+    }
+
+    //header
+    cByteBin header;
+    header.write(FILE_FORMAT_PREFIX,FILE_FORMAT_PREFIX_SIZE);
+    header.writeInt(FILE_FORMAT_VERSION);
+
+    //strings
+    header.writeVarUint(strings.size());
+    for (int i = 0; i<strings.size(); i++)
+        header.writeVarString(strings[i]);
 
-        //if at any step of saving app fail proceed - old db will not damaged and can be restored
-        QFile::rename(m_StorageFileName, m_StorageFileName+".old");
-        QFile::rename(m_StorageFileName+".new", m_StorageFileName);
-        QFile::remove(m_StorageFileName+".old");
+    file.write(header.data());
+    file.write(body.data());
+    file.close();
+    if (file.error()!=QFileDevice::NoError)
+        return false;
+
+    //if at any step of saving app fail proceed - old db will not damaged and can be restored
+    QFile::rename(FileName, FileName+".old");
+    QFile::rename(FileName+".new", FileName);
+    QFile::remove(FileName+".old");
+    return true;
+}
+
+void cDataManager::saveDB()
+{
+    if (m_StorageFileName.isEmpty())
+        return;
+    m_CompactionWatcher.waitForFinished();
+    if (writeDB(makeSnapshot(),m_StorageFileName)){
+        //everything journaled is in snapshot now
+        m_Journal.close();
+        QFile::remove(cDBJournal::compactingFileName(m_StorageFileName));
+        QFile::remove(cDBJournal::journalFileName(m_StorageFileName));
+        m_Journal.open(m_StorageFileName);
     }
 }
 
+void cDataManager::compactDB()
+{
+    if (m_StorageFileName.isEmpty() || m_CompactionWatcher.isRunning())
+        return;
+    if (!m_Journal.rotate()){
+        saveDB();
+        return;
+    }
+    m_CompactionFileName = m_StorageFileName;
+    m_CompactionWatcher.setFuture(QtConcurrent::run(&cDataManager::writeDB,makeSnapshot(),m_StorageFileName));
+}
+
+void cDataManager::onCompactionFinished()
+{
+    if (m_CompactionWatcher.result())
+        QFile::remove(cDBJournal::compactingFileName(m_CompactionFileName));
+    else
+        qCritical() << "cDataManager: db compaction failed. journal will be folded on next compaction";
+}
+
 void cDataManager::loadDB()
 {
     qDebug() << "cDataManager: store file " << m_StorageFileName;
-    if (m_StorageFileName.isEmpty())
-        return;
-    if (!QFile(m_StorageFileName).exists())
+    m_CompactionWatcher.waitForFinished();
+    m_Journal.close();
+    if (m_StorageFileName.isEmpty()){
+        addDefaultProfile();
+        rebuildIndex();
+        rebuildDays();
         return;
+    }
+    if (QFile(m_StorageFileName).exists())
+        loadSnapshot();
+    addDefaultProfile();
+
+    replayJournal(cDBJournal::compactingFileName(m_StorageFileName));
+    replayJournal(cDBJournal::journalFileName(m_StorageFileName));
+    rebuildIndex();
+    rebuildDays();
+    m_Journal.open(m_StorageFileName);
+}
+
+void cDataManager::addDefaultProfile()
+{
+    if (m_Profiles.empty()){
+        sProfile defaultProfile;
+        defaultProfile.name = tr("Default");
+        m_Profiles.push_back(defaultProfile);
+    }
+}
+
+//element count followed by elements at least minSize bytes each. broken count gives empty container
+static int readCount(cMemoryBin& file, int minSize)
+{
+    quint64 count = file.readVarUint();
+    if (count>static_cast<quint64>(file.bytesAvailable()/minSize)){
+        qCritical() << "Error loading db. Broken elements count at " << file.pos();
+        return 0;
+    }
+    return static_cast<int>(count);
+}
+
+static QString stringAt(const QVector<QString>& strings, quint64 index, bool& broken)
+{
+    if (index>=static_cast<quint64>(strings.size())){
+        broken = true;
+        return QString();
+    }
+    return strings[static_cast<int>(index)];
+}
+
+bool cDataManager::readDB(cMemoryBin &file, int Version, sDBSnapshot &snapshot)
+{
+    bool broken = false;
+
+    //strings
+    QVector<QString> strings;
+    strings.resize(readCount(file,1));
+    for (int i = 0; i<strings.size(); i++)
+        strings[i] = file.readVarString();
+    auto readString = [&](){return stringAt(strings,file.readVarUint(),broken);};
+
+    //profiles
+    snapshot.profiles.resize(readCount(file,1));
+    for (int i = 0; i<snapshot.profiles.size(); i++){
+        snapshot.profiles[i].name = readString();
+    }
+    snapshot.currentProfile = file.readVarInt();
+
+    //categories
+    snapshot.categories.resize(readCount(file,5));
+    for (int i = 0; i<snapshot.categories.size(); i++){
+        snapshot.categories[i].name = readString();
+        snapshot.categories[i].color = QColor::fromRgba(file.readUint());
+    }
+
+    //applications
+    snapshot.applications.resize(readCount(file,5));
+    for (int i = 0; i<snapshot.applications.size(); i++){
+        sAppSnapshot& app = snapshot.applications[i];
+        quint64 flags = file.readVarUint();
+        app.visible = (flags&1)!=0;
+        app.useCustomScript = (flags&2)!=0;
+        app.trackerType = file.readVarUint();
+        app.path = readString();
+        app.customScript = readString();
+        if (Version>=FILE_FORMAT_RULES_VERSION)
+            app.rules = readString();
+
+        app.activities.resize(qMax(1,readCount(file,3)));
+        for (int activity = 0; activity<app.activities.size(); activity++){
+            sActivityInfo* info = &app.activities[activity];
+            info->name = readString();
+
+            //app category for every profile
+            info->categories.resize(readCount(file,1));
+            for (int j = 0; j<info->categories.size(); j++){
+                quint64 value = file.readVarUint();
+                info->categories[j].category = static_cast<int>(cMemoryBin::unzigzag(value>>1));
+                info->categories[j].visible = (value&1)!=0;
+            }
+
+            //total use time. stored as rows(start delta, length, profile), kept in memory as columns
+            int periodsCount = readCount(file,3);
+            info->periods.resize(periodsCount);
+            quint32* start = info->periods.start.data();
+            qint32* length = info->periods.length.data();
+            quint16* profileIndex = info->periods.profileIndex.data();
+            qint64 prevEnd = 0;
+            for (int j = 0; j<periodsCount; j++){
+                start[j] = static_cast<quint32>(prevEnd+file.readVarInt());
+                length[j] = static_cast<qint32>(file.readVarUint());
+                profileIndex[j] = static_cast<quint16>(file.readVarUint());
+                prevEnd = static_cast<qint64>(start[j])+length[j];
+            }
+        }
+    }
+    if (broken)
+        qCritical() << "Error loading db. Broken string reference";
+    return !file.isOverflow();
+}
+
+void cDataManager::applySnapshot(const sDBSnapshot &snapshot)
+{
+    m_Profiles = snapshot.profiles;
+    m_CurrentProfile = snapshot.currentProfile;
+    m_Categories = snapshot.categories;
+    m_Applications.resize(snapshot.applications.size());
+    for (int i = 0; i<m_Applications.size(); i++){
+        const sAppSnapshot& app = snapshot.applications[i];
+        m_Applications[i] = new sAppInfo();
+        m_Applications[i]->visible = app.visible;
+        m_Applications[i]->path = app.path;
+        m_Applications[i]->trackerType = static_cast<sAppInfo::eTrackerType>(app.trackerType);
+        m_Applications[i]->useCustomScript = app.useCustomScript;
+        m_Applications[i]->customScript = app.customScript;
+        m_Applications[i]->rules = app.rules;
+        m_Applications[i]->activities = app.activities;
+        for (int j = 0; j<m_Applications[i]->activities.size(); j++)
+            m_Applications[i]->activities[j].nameUpcase = m_Applications[i]->activities[j].name.toUpper();
+        m_Applications[i]->predefinedInfo = new cAppPredefinedInfo(m_Applications[i]->activities[0].name);
+    }
+}
+
+void cDataManager::loadSnapshot()
+{
     qDebug() << "cDataManager: start DB loading";
     for (int i = 0; i<m_Applications.size(); i++)
         delete m_Applications[i];
     m_Applications.resize(0);
 
-    convertToVersion4(m_StorageFileName,m_StorageFileName);
-    cFileBin file( m_StorageFileName );
-    if ( file.open(QIODevice::ReadOnly) )
-    {
-        //check header
-        char prefix[FILE_FORMAT_PREFIX_SIZE+1]; //add zero for simple convert to string
-        prefix[FILE_FORMAT_PREFIX_SIZE] = 0;
-        file.read(prefix,FILE_FORMAT_PREFIX_SIZE);
-        if (memcmp(prefix,FILE_FORMAT_PREFIX,FILE_FORMAT_PREFIX_SIZE)==0){
-            int Version = file.readInt();
-            if (Version==FILE_FORMAT_VERSION){
-
-                //profiles
-                m_Profiles.resize(file.readInt());
-                for (int i = 0; i<m_Profiles.size(); i++){
-                    m_Profiles[i].name = file.readString();
-                }
-                m_CurrentProfile = file.readInt();
+    cFileBin dbFile( m_StorageFileName );
+    if ( !dbFile.open(QIODevice::ReadOnly) )
+        return;
+    //decode directly from mapped file in one pass instead of millions of small reads.
+    //all periods are still copied into model, mapping is released after load: db.bin is replaced by rename
+    //on compaction and mapped file can't be renamed on Windows
+    uchar* mapped = dbFile.map(0,dbFile.size());
+    if (!mapped){
+        qCritical() << "Error loading db. Can't map file " << m_StorageFileName << " " << dbFile.errorString();
+        dbFile.close();
+        return;
+    }
+    cMemoryBin file(mapped,dbFile.size());
+
+    //file is read once, old versions are decoded straight into current model
+    sDBSnapshot snapshot;
+    bool loaded = false;
+    int Version = readDBHeader(file);
+    if (Version>=FILE_FORMAT_BASE_VERSION && Version<=FILE_FORMAT_VERSION)
+        loaded = readDB(file,Version,snapshot);
+    else
+    if (Version>0 && Version<FILE_FORMAT_BASE_VERSION)
+        loaded = readOldDB(file,Version,snapshot);
+    else
+    if (Version==-1)
+        qCritical() << "Error loading db. Incorrect file format prefix " << m_StorageFileName;
+    else
+        qCritical() << "Error loading db. Incorrect file format version " << Version << " only " << FILE_FORMAT_VERSION << " supported";
+    if (file.isOverflow())
+        qCritical() << "Error loading db. Unexpected end of file " << m_StorageFileName;
+
+    dbFile.unmap(mapped);
+    dbFile.close();
+
+    if (Version>0 && Version<=FILE_FORMAT_VERSION)
+        applySnapshot(snapshot);
+
+    //old db is kept as backup and replaced by current format only if it was decoded without errors
+    if (Version>0 && Version<FILE_FORMAT_VERSION){
+        QFile::copy(m_StorageFileName,m_StorageFileName+".version."+QString::number(Version));
+        if (loaded && writeDB(snapshot,m_StorageFileName)){
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
+            qInfo() << "db converted from version " << Version << " to version " << FILE_FORMAT_VERSION;
+#endif
+        }
+        else
+            qCritical() << "Error converting db to version " << FILE_FORMAT_VERSION;
+    }
+    qDebug() << "cDataManager: end DB loading\n";
+}
 
-                //categories
-                m_Categories.resize(file.readInt());
-                for (int i = 0; i<m_Categories.size(); i++){
-                    m_Categories[i].name = file.readString();
-                    m_Categories[i].color = QColor::fromRgba(file.readUint());
-                }
+void cDataManager::replayJournal(const QString &FileName)
+{
+    cFileBin file(FileName);
+    if (!file.exists())
+        return;
+    if (!file.open(QIODevice::ReadOnly)){
+        qCritical() << "Error replaying journal. Can't open " << FileName;
+        return;
+    }
+    if (!cDBJournal::checkHeader(file)){
+        qCritical() << "Error replaying journal. Incorrect journal format " << FileName;
+        file.close();
+        return;
+    }
 
-                //applications
-                m_Applications.resize(file.readInt());
-                for (int i = 0; i<m_Applications.size(); i++){
-                    m_Applications[i] = new sAppInfo();
-                    m_Applications[i]->visible = file.readInt()==1;
-                    m_Applications[i]->path = file.readString();
-                    m_Applications[i]->trackerType = static_cast<sAppInfo::eTrackerType>(file.readInt());
-                    m_Applications[i]->useCustomScript = file.readInt()==1;
-                    m_Applications[i]->customScript = file.readString();
-
-                    m_Applications[i]->activities.resize(file.readInt());
-                    for (int activity = 0; activity<m_Applications[i]->activities.size(); activity++){
-                        sActivityInfo* info = &m_Applications[i]->activities[activity];                        
-                        info->name = file.readString();
-                        info->nameUpcase = info->name.toUpper();
-
-                        //app category for every profile
-                        info->categories.resize(file.readInt());
-                        for (int j = 0; j<info->categories.size(); j++){
-                            info->categories[j].category = file.readInt();
-                            info->categories[j].visible = file.readInt()==1;
-                        }
-
-                        //total use time
-                        info->periods.resize(file.readInt());
-                        for (int j = 0; j<info->periods.size(); j++){
-                            info->periods[j].start = QDateTime::fromTime_t(file.readUint());
-                            info->periods[j].length = file.readInt();
-                            info->periods[j].profileIndex = file.readInt();
-                        }
-                    }
-                    m_Applications[i]->predefinedInfo = new cAppPredefinedInfo(m_Applications[i]->activities[0].name);
+    int count = 0;
+    cDBJournal::eRecordType type;
+    QByteArray payload;
+    while (cDBJournal::readRecord(file,type,payload)){
+        QDataStream stream(payload);
+        if (!applyJournalRecord(type,stream)){
+            qCritical() << "Error replaying journal. Record " << count << " of type " << type << " does not match db";
+            break;
+        }
+        count++;
+    }
+    file.close();
+    qDebug() << "cDataManager: replayed " << count << " records from " << FileName;
+}
+
+bool cDataManager::applyJournalRecord(cDBJournal::eRecordType type, QDataStream &stream)
+{
+    switch(type){
+        case cDBJournal::RT_PROFILE:{
+            int index;
+            QString name;
+            stream >> index >> name;
+            if (index<0 || index>=m_Profiles.size())
+                return false;
+            m_Profiles[index].name = name;
+        }
+        break;
+        case cDBJournal::RT_CURRENT_PROFILE:{
+            int index;
+            stream >> index;
+            if (index<0 || index>=m_Profiles.size())
+                return false;
+            m_CurrentProfile = index;
+        }
+        break;
+        case cDBJournal::RT_CATEGORY:{
+            int index;
+            QString name;
+            QRgb color;
+            stream >> index >> name >> color;
+            if (index<0 || index>m_Categories.size())
+                return false;
+            if (index==m_Categories.size())
+                m_Categories.push_back(sCategory());
+            m_Categories[index].name = name;
+            m_Categories[index].color = QColor::fromRgba(color);
+        }
+        break;
+        case cDBJournal::RT_APPLICATION:{
+            int index;
+            QString name;
+            QString path;
+            stream >> index >> name >> path;
+            if (index<0 || index>m_Applications.size())
+                return false;
+            if (index==m_Applications.size())
+                m_Applications.push_back(new sAppInfo(name,m_Profiles.size()));
+            else
+            if (m_Applications[index]->activities[0].nameUpcase!=name.toUpper())
+                return false;
+            m_Applications[index]->path = path;
+        }
+        break;
+        case cDBJournal::RT_APPLICATION_SETTINGS:{
+            int index;
+            bool visible;
+            int trackerType;
+            bool useCustomScript;
+            QString customScript;
+            QString rules;
+            stream >> index >> visible >> trackerType >> useCustomScript >> customScript;
+            //rules are appended to record, journals written before them don't have it
+            if (!stream.atEnd())
+                stream >> rules;
+            if (index<0 || index>=m_Applications.size())
+                return false;
+            m_Applications[index]->visible = visible;
+            m_Applications[index]->trackerType = static_cast<sAppInfo::eTrackerType>(trackerType);
+            m_Applications[index]->useCustomScript = useCustomScript;
+            m_Applications[index]->customScript = customScript;
+            m_Applications[index]->rules = rules;
+        }
+        break;
+        case cDBJournal::RT_ACTIVITY:{
+            int appIndex;
+            int index;
+            QString name;
+            stream >> appIndex >> index >> name;
+            if (appIndex<0 || appIndex>=m_Applications.size())
+                return false;
+            QVector<sActivityInfo>& activities = m_Applications[appIndex]->activities;
+            if (index<0 || index>activities.size())
+                return false;
+            if (index==activities.size())
+                activities.push_back(createActivity(name,m_Profiles.size()));
+            else
+            if (activities[index].nameUpcase!=name.toUpper())
+                return false;
+        }
+        break;
+        case cDBJournal::RT_ACTIVITY_STATE:{
+            int appIndex;
+            int activityIndex;
+            int profile;
+            int category;
+            bool visible;
+            stream >> appIndex >> activityIndex >> profile >> category >> visible;
+            if (appIndex<0 || appIndex>=m_Applications.size())
+                return false;
+            if (activityIndex<0 || activityIndex>=m_Applications[appIndex]->activities.size())
+                return false;
+            sActivityInfo& activity = m_Applications[appIndex]->activities[activityIndex];
+            if (profile<0 || profile>=activity.categories.size() || category>=m_Categories.size())
+                return false;
+            activity.categories[profile].category = category;
+            activity.categories[profile].visible = visible;
+        }
+        break;
+        case cDBJournal::RT_PERIOD:{
+            int appIndex;
+            int activityIndex;
+            uint start;
+            int length;
+            int profile;
+            bool exactLength;
+            int index = -1;
+            stream >> appIndex >> activityIndex >> start >> length >> profile >> exactLength;
+            //index is appended to record, journals written before it don't have it
+            if (!stream.atEnd())
+                stream >> index;
+            if (appIndex<0 || appIndex>=m_Applications.size())
+                return false;
+            if (activityIndex<0 || activityIndex>=m_Applications[appIndex]->activities.size())
+                return false;
+            if (profile<0 || profile>=m_Profiles.size())
+                return false;
+            sTimePeriods& periods = m_Applications[appIndex]->activities[activityIndex].periods;
+            //period can be already in snapshot if app crashed in the middle of compaction.
+            //periods are never removed, so index identifies period even if several start in the same second
+            int existing = -1;
+            if (index>=0){
+                if (index>periods.size())
+                    return false;
+                if (index<periods.size()){
+                    if (periods.start[index]!=start || periods.profileIndex[index]!=profile)
+                        return false;
+                    existing = index;
                 }
             }
+            else{
+                for (int i = periods.size()-1; i>=0 && periods.start[i]>=start; i--)
+                    if (periods.start[i]==start && periods.profileIndex[i]==profile){
+                        existing = i;
+                        break;
+                    }
+            }
+            if (existing==-1)
+                periods.append(start,length,profile);
             else
-                qCritical() << "Error loading db. Incorrect file format version " << Version << " only " << FILE_FORMAT_VERSION << " supported";
+            if (exactLength || periods.length[existing]<length)
+                periods.length[existing] = length;
         }
-        else
-            qCritical() << "Error loading db. Incorrect file format prefix " << prefix;
-
-
-        file.close();
+        break;
+        default:
+            return false;
     }
-    qDebug() << "cDataManager: end DB loading\n";
+    return stream.status()==QDataStream::Ok;
 }
 
 void cDataManager::saveJSON()
@@ -624,6 +1405,7 @@ void cDataManager::saveJSON()
       jobj["trackerType"] = app->trackerType;
       jobj["useCustomScript"] = app->useCustomScript;
       jobj["customScript"] = app->customScript;
+      jobj["rules"] = app->rules;
 
       QJsonArray activities;
       for (const auto& info: app->activities) {
@@ -642,11 +1424,11 @@ void cDataManager::saveJSON()
 
         //total use time
         QJsonArray periods;
-        for (const auto& per: info.periods) {
+        for (int i = 0; i<info.periods.size(); i++) {
           QJsonObject jobj;
-          jobj["start"] = per.start.toString("yyyy-mm-dd hh:mm:ss");
-          jobj["length"] = per.length;
-          jobj["profileIndex"] = per.profileIndex;
+          jobj["start"] = QDateTime::fromSecsSinceEpoch(info.periods.start[i]).toString("yyyy-mm-dd hh:mm:ss");
+          jobj["length"] = info.periods.length[i];
+          jobj["profileIndex"] = info.periods.profileIndex[i];
           periods.append(jobj);
         }
         jobj["periods"] = periods;
@@ -677,7 +1459,7 @@ void cDataManager::loadJSON()
         return;
     qDebug() << "cDataManager: start DB loading\n";
 
-//    convertToVersion4(m_StorageFileName,m_StorageFileName);
+//    old versions are converted by loadSnapshot
     QFile file(m_StorageFileName);
     if ( !file.open(QIODevice::ReadOnly) )
       return;
@@ -692,7 +1474,7 @@ void cDataManager::loadJSON()
         qCritical() << "Error loading db. Incorrect file format prefix " << magic;
     }
     const int version = jobj["version"].toInt();
-    if (version != FILE_FORMAT_VERSION) {
+    if (version<FILE_FORMAT_BASE_VERSION || version>FILE_FORMAT_VERSION) {
         qCritical() << "Error loading db. Incorrect file format version " << version << " only " << FILE_FORMAT_VERSION << " supported";
         return;
     }
@@ -732,6 +1514,7 @@ void cDataManager::loadJSON()
       app->trackerType = static_cast<sAppInfo::eTrackerType>(jobj["trackerType"].toInt());
       app->useCustomScript = jobj["useCustomScript"].toBool();
       app->customScript = jobj["customScript"].toString();
+      app->rules = jobj["rules"].toString();
 
       QJsonArray jactivities = jobj["activities"].toArray();
       auto& activities = app->activities;
@@ -765,12 +1548,14 @@ void cDataManager::loadJSON()
           QDateTime start = QDateTime::fromString(jobj["start"].toString(), "yyyy-mm-dd hh:mm:ss");
           int length = jobj["length"].toInt();
           int profileIndex = jobj["profileIndex"].toInt();
-          periods.append({start, length, profileIndex});
+          periods.append(start.toSecsSinceEpoch(), length, profileIndex);
         }
 
       }
       app->predefinedInfo = new cAppPredefinedInfo(activities[0].name);
     }
+    rebuildIndex();
+    rebuildDays();
 
     qDebug() << "cDataManager: end DB loading\n";
 }
@@ -782,10 +1567,13 @@ void cDataManager::loadPreferences()
     m_UpdateDelay = settings.db()->value(CONF_UPDATE_DELAY_ID,m_UpdateDelay).toInt();
     m_IdleDelay = settings.db()->value(CONF_IDLE_DELAY_ID,m_IdleDelay).toInt();
     m_AutoSaveDelay = settings.db()->value(CONF_AUTOSAVE_DELAY_ID,m_AutoSaveDelay).toInt();
+    m_ScriptTimeBudget = settings.db()->value(CONF_SCRIPT_TIME_BUDGET_ID,m_ScriptTimeBudget).toInt();
+    m_TrackersBuffer = settings.db()->value(CONF_TRACKERS_BUFFER_ID,m_TrackersBuffer).toInt();
     m_StorageFileName = settings.db()->value(CONF_STORAGE_FILENAME_ID,m_StorageFileName).toString();
     m_ShowSystemNotifications = settings.db()->value(CONF_NOTIFICATION_SHOW_SYSTEM_ID,m_ShowSystemNotifications).toBool();
     m_ClientMode = settings.db()->value(CONF_CLIENT_MODE_ID,m_ClientMode).toBool();
     m_ClientModeHost = settings.db()->value(CONF_CLIENT_MODE_HOST_ID,m_ClientModeHost).toString();
+    m_ClientModeBinary = settings.db()->value(CONF_CLIENT_MODE_BINARY_ID,m_ClientModeBinary).toBool();
 
     m_BackupDelay = static_cast<eBackupDelay>(settings.db()->value(CONF_BACKUP_DELAY_ID,BD_ONE_WEEK).toInt());
     m_BackupFolder = settings.db()->value(CONF_BACKUP_FILENAME_ID,m_BackupFolder).toString();
@@ -805,16 +1593,58 @@ void cDataManager::loadPreferences()
 
 
 
-void sActivityInfo::incTime(bool FirstTime, int CurrentProfile, int UpdateDelay)
+void sActivityInfo::startPeriod(int CurrentProfile)
+{
+    periods.append(QDateTime::currentSecsSinceEpoch(),0,CurrentProfile);
+}
+
+void sActivityInfo::incTime(int seconds, sDayRange &range)
+{
+    addToDays((qint64)periods.start.last()+periods.length.last(),seconds,periods.profileIndex.last(),range);
+    periods.length.last()+=seconds;
+}
+
+void sActivityInfo::cutLastPeriod(int seconds, sDayRange &range)
 {
-    if (FirstTime){
-        sTimePeriod period;
-        period.start = QDateTime::currentDateTimeUtc();
-        period.length = 0;
-        period.profileIndex = CurrentProfile;
-        periods.push_back(period);
+    seconds = qMin(seconds,periods.length.last());
+    periods.length.last()-=seconds;
+    addToDays((qint64)periods.start.last()+periods.length.last(),seconds,periods.profileIndex.last(),range,-1);
+}
+
+void sActivityInfo::addToDays(qint64 start, int length, int profile, sDayRange &range, int sign)
+{
+    const qint64 end = start+length;
+    while (start<end){
+        if (!range.contains(start)){
+            range.set(start);
+            if (!range.contains(start))
+                break;
+        }
+        const qint64 partEnd = qMin(end,range.end);
+        QVector<int>& seconds = days[range.day];
+        if (seconds.size()<=profile)
+            seconds.resize(profile+1);
+        seconds[profile]+=sign*(partEnd-start);
+        start = partEnd;
     }
-    periods.last().length+=UpdateDelay;
+}
+
+void sActivityInfo::rebuildDays(sDayRange &range)
+{
+    days.clear();
+    const quint32* starts = periods.start.constData();
+    const qint32* lengths = periods.length.constData();
+    const quint16* profiles = periods.profileIndex.constData();
+    for (int i = 0; i<periods.size(); i++)
+        addToDays(starts[i],lengths[i],profiles[i],range);
+}
+
+void sDayRange::set(qint64 time)
+{
+    QDate date = QDateTime::fromSecsSinceEpoch(time).date();
+    start = date.startOfDay().toSecsSinceEpoch();
+    end = date.addDays(1).startOfDay().toSecsSinceEpoch();
+    day = date.toJulianDay();
 }
 
 sAppInfo::sAppInfo(const QString& name, int profilesCount) :
@@ -831,6 +1661,7 @@ sAppInfo::sAppInfo(const QString& name, int profilesCount) :
 //        ainfo.categories[i].visible = false;
 //    }
     activities.push_back(ainfo);
+    activitiesIndex.insert(ainfo.nameUpcase,0);
 
     trackerType = predefinedInfo->trackerType();
     customScript = predefinedInfo->script();
@@ -21,21 +21,40 @@
 
 #include <QObject>
 #include <QString>
-#include <QDateTime>
 #include <QVector>
+#include <QHash>
+#include <QMap>
 #include <QColor>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QReadWriteLock>
+#include <QFutureWatcher>
+#include <QDataStream>
 #include "cexternaltrackers.h"
 #include "cscriptsmanager.h"
+#include "cactivityrules.h"
+#include "cdbjournal.h"
 
 struct sProfile{
     QString name;
 };
 
-struct sTimePeriod{
-    QDateTime start;
-    int length;
-    int profileIndex;
+//periods of one activity stored column by column, so statistic and saving walk contiguous arrays
+struct sTimePeriods{
+    QVector<quint32> start; //UTC, seconds since epoch
+    QVector<qint32> length;
+    QVector<quint16> profileIndex;
+
+    int size() const {return start.size();}
+    bool isEmpty() const {return start.isEmpty();}
+    void resize(int size){start.resize(size); length.resize(size); profileIndex.resize(size);}
+    void reserve(int size){start.reserve(size); length.reserve(size); profileIndex.reserve(size);}
+    void append(quint32 Start, qint32 Length, int ProfileIndex){
+        start.push_back(Start);
+        length.push_back(Length);
+        profileIndex.push_back(ProfileIndex);
+    }
 };
 
 struct sActivityProfileState{
@@ -43,12 +62,27 @@ struct sActivityProfileState{
     bool visible;
 };
 
+//local day bounds of some moment. cached between calls - periods mostly come in time order
+struct sDayRange{
+    qint64 start;
+    qint64 end;
+    qint64 day; //julian day number
+    sDayRange():start(0),end(0),day(0){}
+    bool contains(qint64 time) const {return time>=start && time<end;}
+    void set(qint64 time);
+};
+
 struct sActivityInfo{
     QString name;
     QString nameUpcase;
-    QVector<sTimePeriod> periods;
+    sTimePeriods periods;
     QVector<sActivityProfileState> categories;
-    void incTime(bool FirstTime, int CurrentProfile, int UpdateDelay);
+    QMap<qint64, QVector<int> > days; //julian day number -> seconds for every profile. periods are split at local midnight
+    void startPeriod(int CurrentProfile);
+    void incTime(int seconds, sDayRange& range);
+    void cutLastPeriod(int seconds, sDayRange& range);
+    void addToDays(qint64 start, int length, int profile, sDayRange& range, int sign = 1);
+    void rebuildDays(sDayRange& range);
 };
 
 class cAppPredefinedInfo;
@@ -67,20 +101,41 @@ public:
     eTrackerType trackerType;
     bool useCustomScript;
     QString customScript;
+    QString rules; //activity rules, checked before any script
     cAppPredefinedInfo* predefinedInfo;
 
     QVector<sActivityInfo> activities;
+    QHash<QString,int> activitiesIndex; //upcase name and every seen spelling -> activity index
 public:
     sAppInfo(const QString& name, int profilesCount);
     sAppInfo();
     ~sAppInfo();
 };
+Q_DECLARE_METATYPE(sAppInfo::eTrackerType)
 
 struct sCategory{
     QString name;
     QColor color;
 };
 
+//copy of db used for saving in background. activities are implicitly shared with main data
+struct sAppSnapshot{
+    bool visible;
+    QString path;
+    int trackerType;
+    bool useCustomScript;
+    QString customScript;
+    QString rules;
+    QVector<sActivityInfo> activities;
+};
+
+struct sDBSnapshot{
+    QVector<sProfile> profiles;
+    int currentProfile;
+    QVector<sCategory> categories;
+    QVector<sAppSnapshot> applications;
+};
+
 class cDataManager : public QObject {
     Q_OBJECT
 public:
@@ -95,10 +150,21 @@ public:
     static const int    DEFAULT_SECONDS_UPDATE_DELAY = 1;
     static const int    DEFAULT_SECONDS_IDLE_DELAY = 300;
     static const int    DEFAULT_SECONDS_AUTOSAVE_DELAY = 1500;
+    static const int    DEFAULT_SCRIPT_TIME_BUDGET_MS = 250;
+    static const int    DEFAULT_TRACKERS_BUFFER_KB = 256;
+    static const int    MAX_COMPILED_RULES = 64;
+    static const int    JOURNAL_COMPACTION_SIZE = 4*1024*1024;
+    static const int    SUSPEND_DETECT_MS = 5000;
+    static const int    STABLE_SAMPLE_INTERVAL_MS = 8000;
+    static const int    IDLE_SAMPLE_INTERVAL_MS = 60000;
+    static const int    IDLE_POLL_INTERVAL_MS = 2000;
+    static const int    WAKEUP_COALESCE_MS = 50;
 
     static const QString CONF_UPDATE_DELAY_ID;
     static const QString CONF_IDLE_DELAY_ID;
     static const QString CONF_AUTOSAVE_DELAY_ID;
+    static const QString CONF_SCRIPT_TIME_BUDGET_ID;
+    static const QString CONF_TRACKERS_BUFFER_ID;
     static const QString CONF_STORAGE_FILENAME_ID;
     static const QString CONF_LANGUAGE_ID;
     static const QString CONF_FIRST_LAUNCH_ID;
@@ -115,16 +181,30 @@ public:
     static const QString CONF_AUTORUN_ID;
     static const QString CONF_CLIENT_MODE_ID;
     static const QString CONF_CLIENT_MODE_HOST_ID;
+    static const QString CONF_CLIENT_MODE_BINARY_ID;
     static const QString CONF_LAST_AVAILABLE_VERSION_ID;
     static const QString CONF_BACKUP_FILENAME_ID;
     static const QString CONF_BACKUP_DELAY_ID;
 protected:
-    cExternalTrackers   m_ExternalTrackers;
-    cScriptsManager     m_ScriptsManager;
+    //sampling, scripts and accounting live in tracking thread, gui can't delay them.
+    //helpers bound to thread are created there, model is changed there only under m_DataLock
+    QThread             m_TrackingThread;
+    QReadWriteLock      m_DataLock;
+    cExternalTrackers*  m_ExternalTrackers;
+    cScriptsManager*    m_ScriptsManager;
+    QHash<QString,cActivityRules> m_CompiledRules; //rules text -> matcher, used in tracking thread only
+    const cActivityRules& compiledRules(const QString& rules);
     QTimer              m_MainTimer;
+    cActiveWindowWatcher* m_WindowWatcher;
+    sSysInfo            m_ActiveWindowInfo; //last probed active window, probed again on watcher changes
+    bool                m_ActiveWindowChanged;
+    cDBJournal          m_Journal;
+    QFutureWatcher<bool> m_CompactionWatcher;
+    QString             m_CompactionFileName;
 
     QVector<sCategory>  m_Categories;
     QVector<sAppInfo*>  m_Applications;
+    QHash<QString,int>  m_ApplicationsIndex; //upcase name and every seen spelling -> application index
     QVector<sProfile>   m_Profiles;
 
     int                 m_LastLocalActivity{};
@@ -139,9 +219,10 @@ protected:
 
     bool                m_ClientMode{};
     QString             m_ClientModeHost;
+    bool                m_ClientModeBinary{}; //host reads binary protocol, older hosts read text only
+    int                 m_TrackersBuffer{DEFAULT_TRACKERS_BUFFER_KB}; //KB of trackers socket receive buffer
 
-    int                 m_UpdateCounter;
-    int                 m_UpdateDelay;
+    int                 m_UpdateDelay; //seconds between samples while window changes
 
     QPoint              m_CurrentMousePos;
     int                 m_CurrentApplicationIndex;
@@ -154,11 +235,38 @@ protected:
 
     int                 m_AutoSaveCounter;
     int                 m_AutoSaveDelay;
+
+    int                 m_ScriptTimeBudget; //ms for one call of application script
+
+    QElapsedTimer       m_SampleTimer; //monotonic time of previous sample
+    qint64              m_LastSampleWallClock;
+    qint64              m_ElapsedRemainder; //ms not yet added to periods
+    bool                m_PeriodOpened; //current activity has period which is extended by samples
+    int                 m_SampleInterval; //ms, grows while focus is stable
+    int                 m_ScheduledInterval{}; //ms, longest expected wait for next sample
+    sDayRange           m_DayRange; //day of tracked time, computed again only when day changes
+    int                 m_StatisticSequence{}; //number of last fast update, snapshot includes all updates up to it
+    int takeElapsedSeconds(bool& suspended);
+    void addCurrentActivityTime(int seconds);
+    bool sample(); //returns true if activity is switched
+    int nextSampleInterval(bool changed);
+    void scheduleSample(int interval);
+    bool isTrackingThread(){return QThread::currentThread()==thread();}
+    void rebuildIndex();
+    void rebuildDays();
     int getAppIndex(const sSysInfo& FileInfo);
     int getActivityIndex(int appIndex,const sSysInfo &FileInfo);
     int getActivityIndexDirect(int appIndex, QString activityName);
+    int previousActivityIndex(int appIndex);
+    sDBSnapshot makeSnapshot();
     void saveDB();
+    void compactDB();
     void loadDB();
+    void loadSnapshot();
+    void applySnapshot(const sDBSnapshot& snapshot);
+    void addDefaultProfile();
+    void replayJournal(const QString& FileName);
+    bool applyJournalRecord(cDBJournal::eRecordType type, QDataStream& stream);
     void saveJSON();
     void loadJSON();
 
@@ -167,41 +275,57 @@ public:
     cDataManager();
     virtual ~cDataManager();
 
+    //writes db in current file format, old file is replaced only after successful write
+    static bool writeDB(const sDBSnapshot& snapshot, const QString& FileName);
+    //decodes db of current format after header
+    static bool readDB(cMemoryBin& file, int Version, sDBSnapshot& snapshot);
+
     int profilesCount(){return m_Profiles.size();}
+    //readers from other threads hold it for read while they use model data.
+    //changing methods below are posted to tracking thread and must be called without it
+    QReadWriteLock* dataLock(){return &m_DataLock;}
+    //caller holds data lock, fast updates with this or lower sequence are already in model
+    int statisticSequence(){return m_StatisticSequence;}
+
     const sProfile* profiles(int index);
     int getCurrentProfileIndex(){return m_CurrentProfile;}
-    void setCurrentProfileIndex(int ProfileIndex){ m_CurrentProfile = ProfileIndex; emit profilesChanged();}
-    void setCurrentProfileIndexSafe(int ProfileIndex){
-        if (ProfileIndex<0 || ProfileIndex>=m_Profiles.size())
-            return;
-        setCurrentProfileIndex(ProfileIndex);
-    }
-    void setProfileName(int index, const QString& Name){m_Profiles[index].name = Name; emit profilesChanged();}
-    void addNewProfile(const QString &Name, int CloneProfileIndex = -1);
-    void mergeProfiles(int profile1, int profile2);
+    Q_INVOKABLE void setCurrentProfileIndex(int ProfileIndex);
+    Q_INVOKABLE void setCurrentProfileIndexSafe(int ProfileIndex);
+    Q_INVOKABLE void setProfileName(int index, const QString& Name);
+    Q_INVOKABLE void addNewProfile(const QString &Name, int CloneProfileIndex = -1);
+    Q_INVOKABLE void mergeProfiles(int profile1, int profile2);
 
 
     int categoriesCount(){return m_Categories.size();}
     const sCategory* categories(int index){return &m_Categories[index];}
-    void setCategoryName(int index, const QString& Name){m_Categories[index].name = Name;}
-    void setCategoryColor(int index, const QColor& color){m_Categories[index].color = color;}
-    void addNewCategory(const QString& Name, QColor color);
-    void deleteCategory(int index);
+    Q_INVOKABLE void setCategoryName(int index, const QString& Name);
+    Q_INVOKABLE void setCategoryColor(int index, const QColor& color);
+    Q_INVOKABLE void addNewCategory(const QString& Name, QColor color);
+    Q_INVOKABLE void deleteCategory(int index);
 
     int applicationsCount(){return m_Applications.size();}
     sAppInfo* applications(int index){return m_Applications[index];}
-    void setApplicationActivityCategory(int profile, int appIndex, int activityIndex, int category);
+    Q_INVOKABLE void setApplicationActivityCategory(int profile, int appIndex, int activityIndex, int category);
+    Q_INVOKABLE void setApplicationActivityVisible(int profile, int appIndex, int activityIndex, bool visible);
+    Q_INVOKABLE void setApplicationSettings(int appIndex, sAppInfo::eTrackerType trackerType, bool useCustomScript, const QString& customScript, const QString& rules);
 
     int getCurrentAppliction(){return m_CurrentApplicationIndex;}
     int getCurrentApplictionActivity(){return m_CurrentApplicationActivityIndex;}
 
-    QString getStorageFileName(){return m_StorageFileName;}
-    void setDebugScript(const QString& script){m_DebugScript = script;}
+    QString getStorageFileName();
+    Q_INVOKABLE void setDebugScript(const QString& script);
 
-    void makeBackup();
+    Q_INVOKABLE void makeBackup();
 public slots:
     void process();
     void onPreferencesChanged();
+    void onCompactionFinished();
+    void onActiveWindowChanged();
+    void onUserInput();
+protected slots:
+    void wakeUp();
+    void startTracking();
+    void stopTracking();
 signals:
     void trayShowHint(const QString& text);
     void trayActive();
@@ -212,7 +336,7 @@ signals:
     void debugScriptResult(QString result, const sSysInfo& data, QString trackingResult);
     void showNotification();
 
-    void statisticFastUpdate(int application, int activity, int category, int secondsCount, bool fullUpdate);
+    void statisticFastUpdate(int application, int activity, int category, int secondsCount, bool fullUpdate, int sequence);
 };
 
 #endif // CDATAMANAGER_H
@@ -0,0 +1,243 @@
+/*
+ * TrackYourTime - cross-platform time tracker
+ * Copyright (C) 2015-2017  Alexander Basov <basovav@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "cdbjournal.h"
+#include <QDataStream>
+#include <QDebug>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+const char* JOURNAL_FORMAT_PREFIX = "TYTJR";
+const int JOURNAL_FORMAT_PREFIX_SIZE = 5;
+
+cDBJournal::cDBJournal():m_File(NULL),m_Size(0),m_SyncedSize(-1)
+{
+
+}
+
+static bool syncToDisk(int handle)
+{
+#if defined(Q_OS_WIN)
+    return FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(handle)))!=0;
+#elif defined(Q_OS_LINUX)
+    return fdatasync(handle)==0;
+#else
+    return fsync(handle)==0;
+#endif
+}
+
+cDBJournal::~cDBJournal()
+{
+    close();
+}
+
+bool cDBJournal::open(const QString &storageFileName)
+{
+    close();
+    m_StorageFileName = storageFileName;
+    m_FileName = journalFileName(storageFileName);
+    m_File = new cFileBin(m_FileName);
+    if (!m_File->open(QIODevice::ReadWrite)){
+        qCritical() << "can't open journal " << m_FileName;
+        delete m_File;
+        m_File = NULL;
+        return false;
+    }
+
+    m_Size = m_File->size();
+    if (m_Size==0){
+        m_File->write(JOURNAL_FORMAT_PREFIX,JOURNAL_FORMAT_PREFIX_SIZE);
+        m_File->writeInt(JOURNAL_FORMAT_VERSION);
+        m_File->flush();
+    }
+    else{
+        //skip already written records. broken tail(if app crashed while writing) will be overwritten
+        m_File->seek(0);
+        if (!checkHeader(*m_File)){
+            qCritical() << "broken journal " << m_FileName << " recreated";
+            m_File->resize(0);
+            m_File->write(JOURNAL_FORMAT_PREFIX,JOURNAL_FORMAT_PREFIX_SIZE);
+            m_File->writeInt(JOURNAL_FORMAT_VERSION);
+        }
+        else{
+            eRecordType type;
+            QByteArray payload;
+            qint64 pos = m_File->pos();
+            while (readRecord(*m_File,type,payload))
+                pos = m_File->pos();
+            m_File->resize(pos);
+            m_File->seek(pos);
+        }
+        m_File->flush();
+    }
+    m_Size = m_File->pos();
+    m_SyncedSize = -1;
+    return true;
+}
+
+void cDBJournal::close()
+{
+    if (m_File){
+        m_File->close();
+        delete m_File;
+        m_File = NULL;
+    }
+    m_Size = 0;
+}
+
+bool cDBJournal::rotate()
+{
+    if (!m_File)
+        return false;
+    QString storageFileName = m_StorageFileName;
+    QString compactingName = compactingFileName(storageFileName);
+    close();
+    if (QFile::exists(compactingName)){
+        cFileBin compacting(compactingName);
+        cFileBin journal(m_FileName);
+        if (compacting.open(QIODevice::Append) && journal.open(QIODevice::ReadOnly)){
+            if (checkHeader(journal))
+                compacting.write(journal.readAll());
+            compacting.close();
+            journal.close();
+            QFile::remove(m_FileName);
+        }
+        else
+            qCritical() << "can't append journal " << m_FileName << " to " << compactingName;
+    }
+    else
+    if (!QFile::rename(m_FileName,compactingName))
+        qCritical() << "can't move journal " << m_FileName;
+    return open(storageFileName);
+}
+
+void cDBJournal::writeRecord(cDBJournal::eRecordType type, const QByteArray &payload)
+{
+    if (!m_File)
+        return;
+    m_File->writeInt(type);
+    m_File->writeInt(payload.size());
+    m_File->writeInt(qChecksum(payload.constData(),payload.size()));
+    m_File->write(payload);
+    m_Size+=RECORD_HEADER_SIZE+payload.size();
+}
+
+void cDBJournal::writeProfile(int index, const QString &name)
+{
+    QByteArray payload;
+    QDataStream stream(&payload,QIODevice::WriteOnly);
+    stream << index << name;
+    writeRecord(RT_PROFILE,payload);
+}
+
+void cDBJournal::writeCurrentProfile(int index)
+{
+    QByteArray payload;
+    QDataStream stream(&payload,QIODevice::WriteOnly);
+    stream << index;
+    writeRecord(RT_CURRENT_PROFILE,payload);
+}
+
+void cDBJournal::writeCategory(int index, const QString &name, const QColor &color)
+{
+    QByteArray payload;
+    QDataStream stream(&payload,QIODevice::WriteOnly);
+    stream << index << name << color.rgba();
+    writeRecord(RT_CATEGORY,payload);
+}
+
+void cDBJournal::writeApplication(int index, const QString &name, const QString &path)
+{
+    QByteArray payload;
+    QDataStream stream(&payload,QIODevice::WriteOnly);
+    stream << index << name << path;
+    writeRecord(RT_APPLICATION,payload);
+}
+
+void cDBJournal::writeApplicationSettings(int index, bool visible, int trackerType, bool useCustomScript, const QString &customScript, const QString &rules)
+{
+    QByteArray payload;
+    QDataStream stream(&payload,QIODevice::WriteOnly);
+    stream << index << visible << trackerType << useCustomScript << customScript << rules;
+    writeRecord(RT_APPLICATION_SETTINGS,payload);
+}
+
+void cDBJournal::writeActivity(int appIndex, int index, const QString &name)
+{
+    QByteArray payload;
+    QDataStream stream(&payload,QIODevice::WriteOnly);
+    stream << appIndex << index << name;
+    writeRecord(RT_ACTIVITY,payload);
+}
+
+void cDBJournal::writeActivityState(int appIndex, int activityIndex, int profile, int category, bool visible)
+{
+    QByteArray payload;
+    QDataStream stream(&payload,QIODevice::WriteOnly);
+    stream << appIndex << activityIndex << profile << category << visible;
+    writeRecord(RT_ACTIVITY_STATE,payload);
+}
+
+void cDBJournal::writePeriod(int appIndex, int activityIndex, int index, uint start, int length, int profile, bool exactLength)
+{
+    QByteArray payload;
+    QDataStream stream(&payload,QIODevice::WriteOnly);
+    stream << appIndex << activityIndex << start << length << profile << exactLength << index;
+    writeRecord(RT_PERIOD,payload);
+}
+
+void cDBJournal::flush()
+{
+    if (!m_File)
+        return;
+    m_File->flush();
+    //idle ticks don't write records and don't touch disk
+    if (m_SyncedSize==m_Size)
+        return;
+    if (!syncToDisk(m_File->handle()))
+        qWarning() << "can't sync journal " << m_FileName;
+    m_SyncedSize = m_Size;
+}
+
+bool cDBJournal::readRecord(cFileBin &file, cDBJournal::eRecordType &type, QByteArray &payload)
+{
+    if (file.bytesAvailable()<RECORD_HEADER_SIZE)
+        return false;
+    type = static_cast<eRecordType>(file.readInt());
+    int size = file.readInt();
+    int checksum = file.readInt();
+    if (size<0 || file.bytesAvailable()<size)
+        return false;
+    payload = file.read(size);
+    return qChecksum(payload.constData(),payload.size())==checksum;
+}
+
+bool cDBJournal::checkHeader(cFileBin &file)
+{
+    char prefix[JOURNAL_FORMAT_PREFIX_SIZE];
+    if (file.read(prefix,JOURNAL_FORMAT_PREFIX_SIZE)!=JOURNAL_FORMAT_PREFIX_SIZE)
+        return false;
+    if (memcmp(prefix,JOURNAL_FORMAT_PREFIX,JOURNAL_FORMAT_PREFIX_SIZE)!=0)
+        return false;
+    if (file.bytesAvailable()<(qint64)sizeof(int))
+        return false;
+    return file.readInt()==JOURNAL_FORMAT_VERSION;
+}
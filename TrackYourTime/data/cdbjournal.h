@@ -0,0 +1,88 @@
+/*
+ * TrackYourTime - cross-platform time tracker
+ * Copyright (C) 2015-2017  Alexander Basov <basovav@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef CDBJOURNAL_H
+#define CDBJOURNAL_H
+
+#include <QString>
+#include <QByteArray>
+#include <QColor>
+#include "../tools/cfilebin.h"
+
+/*
+ * Write-ahead journal stored next to db.bin.
+ * Every record is [type][payload size][payload checksum][payload], payload is written with QDataStream.
+ * Records hold absolute values(not increments), so replaying journal over snapshot that already
+ * contains some of records is safe.
+ */
+class cDBJournal
+{
+public:
+    enum eRecordType{
+        RT_PROFILE = 1,         //index, name
+        RT_CURRENT_PROFILE,     //index
+        RT_CATEGORY,            //index, name, color
+        RT_APPLICATION,         //index, name, path
+        RT_APPLICATION_SETTINGS,//index, visible, trackerType, useCustomScript, customScript, rules
+        RT_ACTIVITY,            //app, index, name
+        RT_ACTIVITY_STATE,      //app, activity, profile, category, visible
+        RT_PERIOD               //app, activity, start, length, profile, exact length, index
+    };
+
+    static const int    JOURNAL_FORMAT_VERSION = 1;
+    static const int    RECORD_HEADER_SIZE = 3*sizeof(int);
+protected:
+    QString             m_StorageFileName;
+    QString             m_FileName;
+    cFileBin*           m_File;
+    qint64              m_Size;
+    qint64              m_SyncedSize; //size which is known to be on disk, -1 after open
+
+    void writeRecord(eRecordType type, const QByteArray& payload);
+public:
+    cDBJournal();
+    ~cDBJournal();
+
+    static QString journalFileName(const QString& storageFileName){return storageFileName+".journal";}
+    static QString compactingFileName(const QString& storageFileName){return storageFileName+".journal.compacting";}
+
+    bool open(const QString& storageFileName);
+    void close();
+    bool isOpen(){return m_File!=NULL;}
+    qint64 size(){return m_Size;}
+
+    //close current journal and move it aside, so snapshot can be written while new records go to fresh journal.
+    //if previous compaction failed records are appended to not yet folded journal
+    bool rotate();
+
+    void writeProfile(int index, const QString& name);
+    void writeCurrentProfile(int index);
+    void writeCategory(int index, const QString& name, const QColor& color);
+    void writeApplication(int index, const QString& name, const QString& path);
+    void writeApplicationSettings(int index, bool visible, int trackerType, bool useCustomScript, const QString& customScript, const QString& rules);
+    void writeActivity(int appIndex, int index, const QString& name);
+    void writeActivityState(int appIndex, int activityIndex, int profile, int category, bool visible);
+    void writePeriod(int appIndex, int activityIndex, int index, uint start, int length, int profile, bool exactLength);
+    //called once per tick. new records are pushed to disk(not only to OS cache), so power loss loses at most one tick
+    void flush();
+
+    //read next record from journal file. return false on end of file or broken(not fully written) record
+    static bool readRecord(cFileBin& file, eRecordType& type, QByteArray& payload);
+    static bool checkHeader(cFileBin& file);
+};
+
+#endif // CDBJOURNAL_H
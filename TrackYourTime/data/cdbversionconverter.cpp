@@ -15,6 +15,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+
 #include "cdbversionconverter.h"
 #include "../tools/cfilebin.h"
 #include <QDebug>
@@ -22,367 +23,113 @@
 
 const char* FILE_FORMAT_PREFIX = "TYTDB";
 
-int getDBVersion(const QString& FileName){
-    int Version = -1;
-    cFileBin file(FileName);
-    if (file.open(QIODevice::ReadOnly)){
-        char prefix[FILE_FORMAT_PREFIX_SIZE+1]; //add zero for simple convert to string
-        prefix[FILE_FORMAT_PREFIX_SIZE] = 0;
-        file.read(prefix,FILE_FORMAT_PREFIX_SIZE);
-        if (memcmp(prefix,FILE_FORMAT_PREFIX,FILE_FORMAT_PREFIX_SIZE)==0){
-            Version = file.readInt();
-        }
-        file.close();
-    }
-    return Version;
+int readDBHeader(cMemoryBin &file)
+{
+    char prefix[FILE_FORMAT_PREFIX_SIZE];
+    if (!file.read(prefix,FILE_FORMAT_PREFIX_SIZE))
+        return -1;
+    if (memcmp(prefix,FILE_FORMAT_PREFIX,FILE_FORMAT_PREFIX_SIZE)!=0)
+        return -1;
+    return file.readInt();
 }
 
-bool convertToVersion2(const QString& SrcFileName,const QString& DstFileName, bool makeBackup)
+//element count followed by elements at least minSize bytes each. broken count gives empty container
+static int readCount(cMemoryBin& file, int minSize)
 {
-    int CurrentVersion = getDBVersion(SrcFileName);
-    if (CurrentVersion==-1){
-        qCritical() << "can't access file " << SrcFileName << " or incorrect/broken file";
-        return false;
-    }
-    if (CurrentVersion==0){
-        qCritical() << "incorrect db version 0";
-        return false;
+    int count = file.readInt();
+    if (count<0 || count>file.bytesAvailable()/minSize){
+        qCritical() << "Error loading db. Broken elements count at " << file.pos();
+        return 0;
     }
-    if (CurrentVersion==2){
-        if (SrcFileName==DstFileName)
-            return true;
-        return QFile::copy(SrcFileName,DstFileName);
-    }
-    if (CurrentVersion>2){
-        qCritical() << "can't convert db to version 2. too high version " << CurrentVersion;
-        return false;
-    }
-
-    //CURRENT VERSION == 1
-    QString tmpFileName = DstFileName+"_";
-    cFileBin out(tmpFileName);
-    cFileBin file(SrcFileName);
-    if (file.open(QIODevice::ReadOnly)){
-        bool success = false;
-        if (out.open(QIODevice::WriteOnly)){
-            char prefix[FILE_FORMAT_PREFIX_SIZE+1]; //add zero for simple convert to string
-            prefix[FILE_FORMAT_PREFIX_SIZE] = 0;
-            file.read(prefix,FILE_FORMAT_PREFIX_SIZE);
-            file.readInt();//version - its 1. no variants
-            //header
-            out.write(FILE_FORMAT_PREFIX,FILE_FORMAT_PREFIX_SIZE);
-            out.writeInt(2);
-
-            //profiles
-            int profilesCount = file.readInt();
-            out.writeInt(profilesCount);
-            for (int i = 0; i<profilesCount; i++)
-                out.writeString(file.readString());//profile name
-            out.writeInt(file.readInt());//current profile
-
-            //categories
-            int categoriesCount = file.readInt();
-            out.writeInt(categoriesCount);
-            for (int i = 0; i<categoriesCount; i++){
-                out.writeString(file.readString());//category name
-                out.writeInt(file.readInt());//category color
-            }
-
-            //applications
-            int appCount = file.readInt();
-            out.writeInt(appCount);
-            for (int i = 0; i<appCount; i++){
-                out.writeInt(1);//app is visible
-                QString name = file.readString();
-                out.writeString(file.readString());//path
-                out.writeInt(sAppInfo::eTrackerType::TT_EXECUTABLE_DETECTOR);
-                out.writeString("");
-
-                //activities
-                out.writeInt(1); //activities count - only default
-                out.writeInt(1);//activity is visible
-                out.writeString(name); //name
-
-                categoriesCount = file.readInt();
-                out.writeInt(categoriesCount);
-                for (int j = 0; j<categoriesCount; j++)
-                    out.writeInt(file.readInt());
-
-                int periodsCount = file.readInt();
-                out.writeInt(periodsCount);
-                for (int j = 0; j<periodsCount; j++){
-                    out.writeUint(file.readUint());
-                    out.writeInt(file.readInt());
-                    out.writeInt(file.readInt());
-                }
-            }
-
-            out.close();
-            success = true;
-        }
-        else
-            success = false;
-        file.close();
-        if (success){
-            if (makeBackup)
-                QFile::rename(DstFileName,DstFileName+".version.1");
-            QFile::remove(DstFileName);
-            QFile::rename(tmpFileName,DstFileName);
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
-            qInfo() << "db converted from version 1 to version 2";
-#endif
-        }
-        return success;
-    }
-    else
-        return false;
+    return count;
 }
 
-bool convertToVersion3(const QString &SrcFileName, const QString &DstFileName, bool makeBackup)
+static void readOldActivity(cMemoryBin& file, int Version, sActivityInfo& info)
 {
-    int CurrentVersion = getDBVersion(SrcFileName);
-    if (CurrentVersion==3){
-        if (SrcFileName==DstFileName)
-            return true;
-        return QFile::copy(SrcFileName,DstFileName);
-    }
-    if (CurrentVersion>3){
-        qCritical() << "can't convert db to version 3. too high version " << CurrentVersion;
-        return false;
+    //app category for every profile
+    info.categories.resize(readCount(file,sizeof(int)));
+    for (int i = 0; i<info.categories.size(); i++){
+        info.categories[i].category = file.readInt();
+        info.categories[i].visible = Version>=3?file.readInt()==1:false;
     }
-    if (CurrentVersion<2){
-        if (!convertToVersion2(SrcFileName, DstFileName, makeBackup))
-            return false;
-        makeBackup = false;
-    }
-
-
-    //CURRENT VERSION == 2
-    QString tmpFileName = DstFileName+"_";
-    cFileBin out(tmpFileName);
-    cFileBin file(SrcFileName);
-    if (file.open(QIODevice::ReadOnly)){
-        bool success = false;
-        if (out.open(QIODevice::WriteOnly)){
-            char prefix[FILE_FORMAT_PREFIX_SIZE+1]; //add zero for simple convert to string
-            prefix[FILE_FORMAT_PREFIX_SIZE] = 0;
-            file.read(prefix,FILE_FORMAT_PREFIX_SIZE);
-            file.readInt();//version - its 2. no variants
-            //header
-            out.write(FILE_FORMAT_PREFIX,FILE_FORMAT_PREFIX_SIZE);
-            out.writeInt(3);
 
-            //profiles
-            int profilesCount = file.readInt();
-            out.writeInt(profilesCount);
-            for (int i = 0; i<profilesCount; i++)
-                out.writeString(file.readString());//profile name
-            out.writeInt(file.readInt());//current profile
-
-            //categories
-            int categoriesCount = file.readInt();
-            out.writeInt(categoriesCount);
-            for (int i = 0; i<categoriesCount; i++){
-                out.writeString(file.readString());//category name
-                out.writeInt(file.readInt());//category color
-            }
-
-            //applications
-            int appCount = file.readInt();
-            out.writeInt(appCount);
-            for (int i = 0; i<appCount; i++){
-                out.writeInt(file.readInt());
-                out.writeString(file.readString());
-                out.writeInt(file.readInt());
-                out.writeString(file.readString());
-
-                //activities
-                int actCount = file.readInt();
-                out.writeInt(actCount);
-                for (int j = 0; j<actCount; j++){
-                    file.readInt();//skip visible
-                    out.writeString(file.readString());
-
-                    //only read activity
-                    QVector<sActivityProfileState> categories;
-                    categoriesCount = file.readInt();
-                    categories.resize(categoriesCount);
-                    for (int k = 0; k<categoriesCount; k++){
-                        categories[k].category = file.readInt();
-                        categories[k].visible = false;
-                    }
-
-                    QVector<sTimePeriod> periods;
-                    int periodsCount = file.readInt();
-                    periods.resize(periodsCount);
-                    for (int k  = 0; k<periodsCount; k++){
-                        periods[k].start = QDateTime::fromTime_t(file.readUint());
-                        periods[k].length = file.readInt();
-                        periods[k].profileIndex = file.readInt();
-                        categories[periods[k].profileIndex].visible = true;
-                    }
-
-                    //only write activity
-                    out.writeInt(categoriesCount);
-                    for (int k = 0; k<categoriesCount; k++){
-                        out.writeInt(categories[k].category);
-                        out.writeInt(categories[k].visible?1:0);
-                    }
-
-                    out.writeInt(periodsCount);
-                    for (int k  = 0; k<periodsCount; k++){
-                        out.writeUint(periods[k].start.toTime_t());
-                        out.writeInt(periods[k].length);
-                        out.writeInt(periods[k].profileIndex);
-                    }
-                }
-            }
-
-            out.close();
-            success = true;
-        }
-        else
-            success = false;
-        file.close();
-        if (success){
-            if (makeBackup)
-                QFile::rename(DstFileName,DstFileName+".version.2");
-            QFile::remove(DstFileName);
-            QFile::rename(tmpFileName,DstFileName);
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
-            qInfo() << "db converted from version 2 to version 3";
-#endif
-        }
-        return success;
+    //total use time. rows(start, length, profile)
+    int periodsCount = readCount(file,3*sizeof(int));
+    info.periods.resize(periodsCount);
+    quint32* start = info.periods.start.data();
+    qint32* length = info.periods.length.data();
+    quint16* profileIndex = info.periods.profileIndex.data();
+    for (int i = 0; i<periodsCount; i++){
+        start[i] = file.readUint();
+        length[i] = file.readInt();
+        int profile = file.readInt();
+        profileIndex[i] = profile;
+        //VERSION 3 CONVERSION - activity is visible in profiles where it was used
+        if (Version<3 && profile>=0 && profile<info.categories.size())
+            info.categories[profile].visible = true;
     }
-    else
-        return false;
 }
 
-bool convertToVersion4(const QString &SrcFileName, const QString &DstFileName, bool makeBackup)
+bool readOldDB(cMemoryBin &file, int Version, sDBSnapshot &snapshot)
 {
-    int CurrentVersion = getDBVersion(SrcFileName);
-    if (CurrentVersion==4){
-        if (SrcFileName==DstFileName)
-            return true;
-        return QFile::copy(SrcFileName,DstFileName);
-    }
-    if (CurrentVersion>4){
-        qCritical() << "can't convert db to version 4. too high version " << CurrentVersion;
+    if (Version<1 || Version>4){
+        qCritical() << "Error loading db. Can't convert version " << Version;
         return false;
     }
-    if (CurrentVersion<3){
-        if (!convertToVersion3(SrcFileName, DstFileName, makeBackup))
-            return false;
-        makeBackup = false;
-    }
-
 
-    //CURRENT VERSION == 3
-    QString tmpFileName = DstFileName+"_";
-    cFileBin out(tmpFileName);
-    cFileBin file(SrcFileName);
-    if (file.open(QIODevice::ReadOnly)){
-        bool success = false;
-        if (out.open(QIODevice::WriteOnly)){
-            char prefix[FILE_FORMAT_PREFIX_SIZE+1]; //add zero for simple convert to string
-            prefix[FILE_FORMAT_PREFIX_SIZE] = 0;
-            file.read(prefix,FILE_FORMAT_PREFIX_SIZE);
-            file.readInt();//version - its 3. no variants
-            //header
-            out.write(FILE_FORMAT_PREFIX,FILE_FORMAT_PREFIX_SIZE);
-            out.writeInt(4);
-
-            //profiles
-            int profilesCount = file.readInt();
-            out.writeInt(profilesCount);
-            for (int i = 0; i<profilesCount; i++)
-                out.writeString(file.readString());//profile name
-            out.writeInt(file.readInt());//current profile
-
-            //categories
-            int categoriesCount = file.readInt();
-            out.writeInt(categoriesCount);
-            for (int i = 0; i<categoriesCount; i++){
-                out.writeString(file.readString());//category name
-                out.writeInt(file.readInt());//category color
-            }
-
-            //applications
-            int appCount = file.readInt();
-            out.writeInt(appCount);
-            for (int i = 0; i<appCount; i++){
-                out.writeInt(file.readInt());
-                out.writeString(file.readString());
-                int trackerType = file.readInt();
-                //VERSION 4 CONVERSION
-                int useCustomScript = 0;
-                if (trackerType==3){
-                    trackerType = 0;
-                    useCustomScript = 1;
-                };
-
-                out.writeInt(trackerType); //old but converted field
-                out.writeInt(useCustomScript); //new field
-                out.writeString(file.readString());
-
-                //activities
-                int actCount = file.readInt();
-                out.writeInt(actCount);
-                for (int j = 0; j<actCount; j++){
-                    out.writeString(file.readString());
-
-                    //only read activity
-                    QVector<sActivityProfileState> categories;
-                    categoriesCount = file.readInt();
-                    categories.resize(categoriesCount);
-                    for (int k = 0; k<categoriesCount; k++){
-                        categories[k].category = file.readInt();
-                        categories[k].visible = file.readInt();
-                    }
-
-                    QVector<sTimePeriod> periods;
-                    int periodsCount = file.readInt();
-                    periods.resize(periodsCount);
-                    for (int k  = 0; k<periodsCount; k++){
-                        periods[k].start = QDateTime::fromTime_t(file.readUint());
-                        periods[k].length = file.readInt();
-                        periods[k].profileIndex = file.readInt();
-                    }
-
-                    //only write activity
-                    out.writeInt(categoriesCount);
-                    for (int k = 0; k<categoriesCount; k++){
-                        out.writeInt(categories[k].category);
-                        out.writeInt(categories[k].visible?1:0);
-                    }
+    //profiles
+    snapshot.profiles.resize(readCount(file,sizeof(int)));
+    for (int i = 0; i<snapshot.profiles.size(); i++)
+        snapshot.profiles[i].name = file.readString();
+    snapshot.currentProfile = file.readInt();
+
+    //categories
+    snapshot.categories.resize(readCount(file,2*sizeof(int)));
+    for (int i = 0; i<snapshot.categories.size(); i++){
+        snapshot.categories[i].name = file.readString();
+        snapshot.categories[i].color = QColor::fromRgba(file.readUint());
+    }
 
-                    out.writeInt(periodsCount);
-                    for (int k  = 0; k<periodsCount; k++){
-                        out.writeUint(periods[k].start.toTime_t());
-                        out.writeInt(periods[k].length);
-                        out.writeInt(periods[k].profileIndex);
-                    }
-                }
-            }
+    //applications
+    snapshot.applications.resize(readCount(file,2*sizeof(int)));
+    for (int i = 0; i<snapshot.applications.size(); i++){
+        sAppSnapshot& app = snapshot.applications[i];
+        if (Version==1){
+            //VERSION 2 CONVERSION - application became default activity
+            QString name = file.readString();
+            app.visible = true;
+            app.path = file.readString();
+            app.trackerType = sAppInfo::TT_EXECUTABLE_DETECTOR;
+            app.useCustomScript = false;
+            app.activities.resize(1);
+            app.activities[0].name = name;
+            readOldActivity(file,Version,app.activities[0]);
+            continue;
+        }
 
-            out.close();
-            success = true;
+        app.visible = file.readInt()==1;
+        app.path = file.readString();
+        app.trackerType = file.readInt();
+        if (Version>=4){
+            app.useCustomScript = file.readInt()==1;
         }
-        else
-            success = false;
-        file.close();
-        if (success){
-            if (makeBackup)
-                QFile::rename(DstFileName,DstFileName+".version.3");
-            QFile::remove(DstFileName);
-            QFile::rename(tmpFileName,DstFileName);
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 5, 0))
-            qInfo() << "db converted from version 3 to version 4";
-#endif
+        else{
+            //VERSION 4 CONVERSION - custom script was separate tracker type
+            app.useCustomScript = app.trackerType==3;
+            if (app.useCustomScript)
+                app.trackerType = sAppInfo::TT_EXECUTABLE_DETECTOR;
+        }
+        app.customScript = file.readString();
+
+        //activities
+        app.activities.resize(qMax(1,readCount(file,3*sizeof(int))));
+        for (int j = 0; j<app.activities.size(); j++){
+            if (Version==2)
+                file.readInt();//activity visible flag, replaced by per profile flag in version 3
+            app.activities[j].name = file.readString();
+            readOldActivity(file,Version,app.activities[j]);
         }
-        return success;
     }
-    else
-        return false;
+
+    return !file.isOverflow();
 }
@@ -15,6 +15,7 @@
  * You should have received a copy of the GNU General Public License
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+
 #ifndef CDBVERSIONCONVERTER_H
 #define CDBVERSIONCONVERTER_H
 
@@ -23,9 +24,13 @@
 extern const char* FILE_FORMAT_PREFIX;
 const int FILE_FORMAT_PREFIX_SIZE = 5;
 
-int getDBVersion(const QString& FileName);
-bool convertToVersion3(const QString& SrcFileName,const QString& DstFileName, bool makeBackup = true);
-bool convertToVersion4(const QString& SrcFileName,const QString& DstFileName, bool makeBackup = true);
+class cMemoryBin;
+struct sDBSnapshot;
+
+//reads prefix and version from beginning of db. -1 for incorrect prefix
+int readDBHeader(cMemoryBin& file);
+//decodes db of version 1-4 in one pass, fields added in later versions get values old step by step conversion used
+bool readOldDB(cMemoryBin& file, int Version, sDBSnapshot& snapshot);
 
 
 #endif // CDBVERSIONCONVERTER_H
@@ -18,188 +18,468 @@
 
 #include "cexternaltrackers.h"
 #include <QDebug>
-
-const QString EXTERNAL_TRACKER_PREFIX = "TYTET";
-const QString OVERRIDE_TRACKER_PREFIX = "TYTOT";
-const QString EXTERNAL_TRACKER_FORMAT_VERSION = "1";
-
-cExternalTrackers::cExternalTrackers(QObject *parent) : QObject(parent),m_HTTPServer(EXTERNAL_TRACKERS_HTTP_PORT)
+#include <QVarLengthArray>
+#include <QTimer>
+#include <QDateTime>
+#include <QCoreApplication>
+#include <QUrl>
+#include <string.h>
+#include <limits.h>
+#include "../tools/cfilebin.h"
+
+static const char EXTERNAL_TRACKER_PREFIX[] = "TYTET";
+static const char OVERRIDE_TRACKER_PREFIX[] = "TYTOT";
+static const char EXTERNAL_TRACKER_FORMAT_VERSION[] = "1";
+static const char BINARY_TRACKER_MAGIC[] = "TYT2";
+static const int BINARY_TRACKER_MAGIC_SIZE = 4;
+
+cExternalTrackers::cExternalTrackers(QObject *parent) : QObject(parent),m_HTTPServer(EXTERNAL_TRACKERS_HTTP_PORT),
+    m_ReceivedCount(0),
+    m_DroppedCount(0),
+    m_MalformedCount(0),
+    m_LostCount(0),
+    m_InBatch(false),
+    m_BatchChanged(false)
 {
+    m_Clock.start();
+    m_UserName = getUserName();
+    //restarted sender gets new id, so its sequence starts again
+    m_SenderId = static_cast<quint32>(QCoreApplication::applicationPid()) ^ static_cast<quint32>(QDateTime::currentMSecsSinceEpoch());
+    m_SendSequence = 0;
+    m_SentBinary = false;
+    m_SentIdleTime = 0;
+    m_SentTime = -1;
+    m_ReceiveBuffer.resize(RECEIVE_BUFFER_SIZE);
     m_Server.bind(QHostAddress::Any, EXTERNAL_TRACKERS_UDP_PORT);
     connect(&m_Server, SIGNAL(readyRead()), this, SLOT(readyRead()));
 
-    connect(&m_HTTPServer,SIGNAL(dataReady(QString)), this, SLOT(onDataReady(QString)));
+    connect(&m_HTTPServer,SIGNAL(dataReady(QByteArray)), this, SLOT(onDataReady(QByteArray)));
 }
 
-void cExternalTrackers::addPair(const QString& AppName, const QString& CurrentState)
+void cExternalTrackers::addPair(const QString& AppName, const QString& CurrentState, qint64 age)
 {    
-    for (int i = 0; i<m_Pairs.size(); i++){
-        if (m_Pairs[i].HostAppFileName==AppName){
-            m_Pairs[i].ClientState = CurrentState;
-            m_Pairs[i].LifeTime = EXTERNAL_TRACKERS_PAIR_LIFE_TIME_SECOND;
-            return;
+    QHash<QString,sExternalTrackerPair>::iterator it = m_Pairs.find(AppName);
+    if (it!=m_Pairs.end()){
+        it->ExpireTime = m_Clock.elapsed()+EXTERNAL_TRACKERS_PAIR_LIFE_TIME_SECOND*1000-age;
+        if (it->ClientState!=CurrentState){
+            it->ClientState = CurrentState;
+            notifyChanged();
         }
+        return;
     }
 
     sExternalTrackerPair pair;
-    pair.HostAppFileName = AppName;
     pair.ClientState = CurrentState;
-    pair.LifeTime = EXTERNAL_TRACKERS_PAIR_LIFE_TIME_SECOND;
-    m_Pairs.push_back(pair);
+    pair.ExpireTime = m_Clock.elapsed()+EXTERNAL_TRACKERS_PAIR_LIFE_TIME_SECOND*1000-age;
+    m_Pairs.insert(AppName,pair);
+    notifyChanged();
 }
 
-void cExternalTrackers::addOverride(const QString &AppName, const QString &CurrentState, int idleTime)
+void cExternalTrackers::addOverride(const QString &AppName, const QString &CurrentState, int idleTime, qint64 age, int lifeTime)
 {
-    for (int i = 0; i<m_Override.size(); i++){
-        if (m_Override[i].AppFileName==AppName){
-            m_Override[i].State = CurrentState;
-            m_Override[i].LifeTime = OVERRIDE_TRACKERS_PAIR_LIFE_TIME_SECOND;
-            m_Override[i].IdleTime = idleTime;
-            return;
+    const QString key = AppName.toUpper();
+    const qint64 now = m_Clock.elapsed();
+    QHash<QString,sOverrideTrackerInfo>::iterator it = m_Override.find(key);
+    if (it!=m_Override.end()){
+        it->ExpireTime = now+lifeTime*1000-age;
+        it->IdleTime = idleTime;
+        it->IdleSince = now-age-idleTime*1000LL;
+        if (it->State!=CurrentState){
+            it->State = CurrentState;
+            notifyChanged();
         }
+        return;
     }
 
     sOverrideTrackerInfo pair;
     pair.AppFileName = AppName;
     pair.State = CurrentState;
-    pair.LifeTime = OVERRIDE_TRACKERS_PAIR_LIFE_TIME_SECOND;
+    pair.ExpireTime = now+lifeTime*1000-age;
     pair.IdleTime = idleTime;
-    m_Override.push_back(pair);
+    pair.IdleSince = now-age-idleTime*1000LL;
+    m_Override.insert(key,pair);
+    notifyChanged();
+}
+
+void cExternalTrackers::notifyChanged()
+{
+    if (m_InBatch)
+        m_BatchChanged = true;
+    else
+        emit trackersChanged();
+}
+
+void cExternalTrackers::setReceiveBufferSize(int bytes)
+{
+    m_Server.setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption,bytes);
 }
 
 void cExternalTrackers::update()
 {
-    int i = 0;
-    while (i<m_Pairs.size()){
-        m_Pairs[i].LifeTime--;
-        if (m_Pairs[i].LifeTime<=0){
-            m_Pairs[i] = m_Pairs.last();
-            m_Pairs.pop_back();
-        }
+    qint64 now = m_Clock.elapsed();
+    QHash<QString,sExternalTrackerPair>::iterator pair = m_Pairs.begin();
+    while (pair!=m_Pairs.end()){
+        if (pair->ExpireTime<=now)
+            pair = m_Pairs.erase(pair);
         else
-            i++;
+            ++pair;
     }
 
-    i = 0;
-    while (i<m_Override.size()){
-        m_Override[i].LifeTime--;
-        if (m_Override[i].LifeTime<=0){
-            m_Override[i] = m_Override.last();
-            m_Override.pop_back();
-        }
+    QHash<QString,sOverrideTrackerInfo>::iterator tracker = m_Override.begin();
+    while (tracker!=m_Override.end()){
+        if (tracker->ExpireTime<=now)
+            tracker = m_Override.erase(tracker);
         else
-            i++;
+            ++tracker;
+    }
+
+    //restarted clients come with new id, old ones are forgotten when their records are
+    QHash<quint64,sTrackerSender>::iterator sender = m_Senders.begin();
+    while (sender!=m_Senders.end()){
+        if (sender->ExpireTime<=now)
+            sender = m_Senders.erase(sender);
+        else
+            ++sender;
     }
 }
 
 bool cExternalTrackers::getExternalTrackerState(const QString &appName, QString& outValue)
 {
-    for (int i = 0; i<m_Pairs.size(); i++){
-        if (m_Pairs[i].HostAppFileName==appName){
-            outValue = m_Pairs[i].ClientState;
-            return true;
-        }
-    }
-
-    return false;
+    QHash<QString,sExternalTrackerPair>::const_iterator it = m_Pairs.constFind(appName);
+    if (it==m_Pairs.constEnd())
+        return false;
+    outValue = it->ClientState;
+    return true;
 }
 
 sOverrideTrackerInfo *cExternalTrackers::getOverrideTracker()
 {
-    if (m_Override.size()==0)
-        return NULL;
-    int min = m_Override[0].IdleTime;
-    sOverrideTrackerInfo* tracker = &m_Override[0];
-    for (int i = 1; i<m_Override.size(); i++)
-        if (m_Override[i].IdleTime<min){
-            min = m_Override[i].IdleTime;
-            tracker = &m_Override[i];
-        }
+    //clients don't report idle time every second, it grows here until next report
+    qint64 now = m_Clock.elapsed();
+    sOverrideTrackerInfo* tracker = NULL;
+    for (QHash<QString,sOverrideTrackerInfo>::iterator it = m_Override.begin(); it!=m_Override.end(); ++it){
+        it->IdleTime = static_cast<int>((now-it->IdleSince)/1000);
+        if (!tracker || it->IdleTime<tracker->IdleTime)
+            tracker = &it.value();
+    }
     return tracker;
 }
 
-void cExternalTrackers::sendOverrideTracker(const QString &AppName, const QString &CurrentState, int idleTime, const QString &host)
+void cExternalTrackers::sendOverrideTracker(const QString &AppName, const QString &CurrentState, int idleTime, const QString &host, bool binary)
 {
-    QString data;
-    data += "PREFIX="+OVERRIDE_TRACKER_PREFIX;
-    data += "&VERSION=1";
-    data += "&APP_FILENAME="+AppName;
-    data += "&STATE="+CurrentState;
-    data += "&USER_INACTIVE_TIME="+QString::number(idleTime);
-    data += "&USER_NAME="+getUserName();
-    m_Client.writeDatagram(data.toUtf8(),QHostAddress(host),EXTERNAL_TRACKERS_UDP_PORT);
+    const qint64 now = m_Clock.elapsed();
+    if (m_SentTime>=0 && AppName==m_SentApp && CurrentState==m_SentState && host==m_SentHost && binary==m_SentBinary){
+        //host sees idle time of last report plus time since it
+        const int hostIdleTime = m_SentIdleTime+static_cast<int>((now-m_SentTime)/1000);
+        const int heartbeat = binary?CLIENT_HEARTBEAT_SECOND:CLIENT_TEXT_HEARTBEAT_SECOND;
+        if (now-m_SentTime<heartbeat*1000 && hostIdleTime-idleTime<CLIENT_IDLE_TOLERANCE_SECOND)
+            return;
+    }
+    m_SentApp = AppName;
+    m_SentState = CurrentState;
+    m_SentHost = host;
+    m_SentBinary = binary;
+    m_SentIdleTime = idleTime;
+    m_SentTime = now;
+
+    if (!binary){
+        //values are percent-encoded, '&' and '=' in titles don't break fields
+        QByteArray data;
+        data += "PREFIX=";
+        data += OVERRIDE_TRACKER_PREFIX;
+        data += "&VERSION=";
+        data += EXTERNAL_TRACKER_FORMAT_VERSION;
+        data += "&APP_FILENAME="+QUrl::toPercentEncoding(AppName);
+        data += "&STATE="+QUrl::toPercentEncoding(CurrentState);
+        data += "&USER_INACTIVE_TIME="+QByteArray::number(idleTime);
+        data += "&USER_NAME="+QUrl::toPercentEncoding(m_UserName);
+        m_Client.writeDatagram(data,QHostAddress(host),EXTERNAL_TRACKERS_UDP_PORT);
+        return;
+    }
+
+    cByteBin packet;
+    packet.write(BINARY_TRACKER_MAGIC,BINARY_TRACKER_MAGIC_SIZE);
+    packet.writeVarUint(BINARY_FORMAT_VERSION);
+    packet.writeVarUint(BPK_OVERRIDE_TRACKERS);
+    packet.writeVarUint(m_SenderId);
+    packet.writeVarUint(++m_SendSequence);
+    packet.writeVarInt(now);
+    packet.writeVarString(m_UserName);
+    packet.writeVarUint(1);
+    packet.writeVarString(AppName);
+    packet.writeVarString(CurrentState);
+    packet.writeVarUint(idleTime>0?idleTime:0);
+    packet.writeVarInt(now);
+    packet.writeVarUint(CLIENT_TRACKER_LIFE_TIME_SECOND);
+    m_Client.writeDatagram(packet.data(),QHostAddress(host),EXTERNAL_TRACKERS_UDP_PORT);
 }
 
 void cExternalTrackers::readyRead()
 {
-    QByteArray buffer;
-    buffer.resize(m_Server.pendingDatagramSize());
+    //socket is drained on every wake up, everything read is one batch with one notification
+    m_InBatch = true;
+    m_BatchChanged = false;
+    while (m_Server.hasPendingDatagrams()){
+        qint64 size = m_Server.pendingDatagramSize();
+        if (size>m_ReceiveBuffer.size())
+            m_ReceiveBuffer.resize(static_cast<int>(size));
+        qint64 read = m_Server.readDatagram(m_ReceiveBuffer.data(), m_ReceiveBuffer.size());
+        if (read<0){
+            m_DroppedCount++;
+            qWarning() << "external trackers datagram read error: " << m_Server.errorString();
+            break;
+        }
+        m_ReceivedCount++;
+        if (!parsePacket(m_ReceiveBuffer.constData(),static_cast<int>(read)))
+            m_MalformedCount++;
+    }
+    m_InBatch = false;
+    if (m_BatchChanged)
+        emit trackersChanged();
+}
 
-    QHostAddress sender;
-    quint16 senderPort;
+void cExternalTrackers::onDataReady(QByteArray data)
+{
+    parsePacket(data.constData(),data.size());
+}
 
-    m_Server.readDatagram(buffer.data(), buffer.size(), &sender, &senderPort);
-    QString Data(buffer);
-    onDataReady(Data);
+bool cExternalTrackers::parsePacket(const char *data, int size)
+{
+    if (size>=BINARY_TRACKER_MAGIC_SIZE && memcmp(data,BINARY_TRACKER_MAGIC,BINARY_TRACKER_MAGIC_SIZE)==0)
+        return parseBinaryMessage(data,size);
+    return parseMessage(data,size);
 }
 
-void cExternalTrackers::onDataReady(QString data)
+bool cExternalTrackers::parseBinaryMessage(const char *data, int size)
 {
-    QString dataFix = data.simplified().replace("%20"," ");
-    QStringList list = dataFix.split('&');
-    QMap<QString,QString> pairs;
-    for (int i = 0; i<list.size(); i++){
-        QStringList pair = list[i].split('=');
-        if (pair.size()==2){
-            pairs[pair[0]]=pair[1];
-        }
+    cMemoryBin packet(reinterpret_cast<const uchar*>(data)+BINARY_TRACKER_MAGIC_SIZE,size-BINARY_TRACKER_MAGIC_SIZE);
+    quint64 version = packet.readVarUint();
+    if (version!=BINARY_FORMAT_VERSION){
+        qWarning() << "unknown exterinal tracker with binary VERSION=" << version;
+        return false;
+    }
+    quint64 kind = packet.readVarUint();
+    quint64 sender = packet.readVarUint();
+    quint64 sequence = packet.readVarUint();
+    qint64 sendTime = packet.readVarInt();
+    packet.readVarString(); //user name
+    quint64 count = packet.readVarUint();
+    if (packet.isOverflow() || (kind!=BPK_EXTERNAL_TRACKERS && kind!=BPK_OVERRIDE_TRACKERS))
+        return false;
+
+    //late packet holds older states than already applied ones
+    QHash<quint64,sTrackerSender>::iterator last = m_Senders.find(sender);
+    if (last!=m_Senders.end() && sequence<=last->Sequence)
+        return true;
+
+    struct sRecord{
+        QString app;
+        QString state;
+        int idleTime;
+        qint64 age;
+    };
+    //lifetime trailer follows records, they are applied after it is read
+    QVarLengthArray<sRecord,4> records;
+    for (quint64 i = 0; i<count && !packet.isOverflow(); i++){
+        sRecord record;
+        record.app = packet.readVarString();
+        record.state = packet.readVarString().simplified();
+        record.idleTime = static_cast<int>(qMin<quint64>(packet.readVarUint(),INT_MAX));
+        record.age = qMax<qint64>(0,sendTime-packet.readVarInt());
+        if (packet.isOverflow())
+            return false;
+        if (!record.app.isEmpty() && !record.state.isEmpty())
+            records.append(record);
     }
 
-    if (pairs["VERSION"].compare(EXTERNAL_TRACKER_FORMAT_VERSION)!=0){
-        qWarning() << "unknown exterinal tracker with VERSION=" << pairs["VERSION"];
-        return;
+    int lifeTime = OVERRIDE_TRACKERS_PAIR_LIFE_TIME_SECOND;
+    if (packet.bytesAvailable()>0){
+        quint64 value = packet.readVarUint();
+        if (value>0 && !packet.isOverflow())
+            lifeTime = static_cast<int>(qBound<quint64>(OVERRIDE_TRACKERS_PAIR_LIFE_TIME_SECOND,value,MAX_OVERRIDE_TRACKERS_LIFE_TIME_SECOND));
+    }
+    if (packet.isOverflow())
+        return false;
+
+    //packet is applied only when it is fully parsed
+    const qint64 senderExpireTime = m_Clock.elapsed()+(kind==BPK_EXTERNAL_TRACKERS?EXTERNAL_TRACKERS_PAIR_LIFE_TIME_SECOND:lifeTime)*1000;
+    if (last!=m_Senders.end()){
+        m_LostCount+=static_cast<int>(qMin<quint64>(sequence-last->Sequence-1,1000000));
+        last->Sequence = sequence;
+        last->ExpireTime = qMax(last->ExpireTime,senderExpireTime);
+    }
+    else{
+        sTrackerSender info;
+        info.Sequence = sequence;
+        info.ExpireTime = senderExpireTime;
+        m_Senders.insert(sender,info);
     }
 
-    QString state = pairs["STATE"].trimmed();
-    if (state.isEmpty()){
-        //qWarning() << "external tracker state is empty";
-        return;
+    for (int i = 0; i<records.size(); i++){
+        if (kind==BPK_EXTERNAL_TRACKERS)
+            addPair(records[i].app.toUpper(),records[i].state,records[i].age);
+        else
+            addOverride(records[i].app,records[i].state,records[i].idleTime,records[i].age,lifeTime);
     }
+    return true;
+}
 
-    if (pairs["PREFIX"].compare(EXTERNAL_TRACKER_PREFIX)==0){
-        int i = 1;
-        while (true){
-            QString key = "APP_"+QString().setNum(i);
-            if (pairs.contains(key)){
-                addPair(pairs[key].toUpper(),state);
-            }
+//part of received message, points into it
+struct sSlice{
+    const char* data;
+    int size;
+    sSlice():data(NULL),size(0){}
+    sSlice(const char* d, int s):data(d),size(s){}
+    bool isNull() const {return data==NULL;}
+    template<int N> bool equals(const char (&str)[N]) const {return size==N-1 && memcmp(data,str,N-1)==0;}
+    template<int N> bool startsWith(const char (&str)[N]) const {return size>=N-1 && memcmp(data,str,N-1)==0;}
+};
+
+static bool isSpace(char c)
+{
+    return c==' ' || c=='\t' || c=='\n' || c=='\r' || c=='\v' || c=='\f';
+}
+
+static int hexValue(char c)
+{
+    if (c>='0' && c<='9')
+        return c-'0';
+    if (c>='a' && c<='f')
+        return c-'a'+10;
+    if (c>='A' && c<='F')
+        return c-'A'+10;
+    return -1;
+}
+
+static sSlice trimmed(sSlice value)
+{
+    while (value.size>0 && isSpace(value.data[0])){
+        value.data++;
+        value.size--;
+    }
+    while (value.size>0 && isSpace(value.data[value.size-1]))
+        value.size--;
+    return value;
+}
+
+//percent-decoding, whitespaces are trimmed and collapsed to one space
+static QString decoded(const sSlice& value)
+{
+    QVarLengthArray<char,256> buffer(value.size);
+    int size = 0;
+    bool space = false;
+    for (int i = 0; i<value.size; i++){
+        char c = value.data[i];
+        if (c=='%' && i+2<value.size && hexValue(value.data[i+1])>=0 && hexValue(value.data[i+2])>=0){
+            c = static_cast<char>(hexValue(value.data[i+1])*16+hexValue(value.data[i+2]));
+            i+=2;
+        }
+        if (isSpace(c)){
+            space = size>0;
+            continue;
+        }
+        if (space){
+            buffer[size++] = ' ';
+            space = false;
+        }
+        buffer[size++] = c;
+    }
+    return QString::fromUtf8(buffer.constData(),size);
+}
+
+static int toInt(const sSlice& value)
+{
+    sSlice number = trimmed(value);
+    int result = 0;
+    for (int i = 0; i<number.size; i++){
+        if (number.data[i]<'0' || number.data[i]>'9' || result>=100000000)
+            return 0;
+        result = result*10+(number.data[i]-'0');
+    }
+    return result;
+}
+
+bool cExternalTrackers::parseMessage(const char *data, int size)
+{
+    sSlice prefix, version, state, appFileName, inactiveTime;
+    QVarLengthArray<sSlice,8> apps; //APP_1..APP_N
+
+    const char* end = data+size;
+    const char* field = data;
+    while (field<end){
+        const char* fieldEnd = static_cast<const char*>(memchr(field,'&',end-field));
+        if (!fieldEnd)
+            fieldEnd = end;
+        const char* separator = static_cast<const char*>(memchr(field,'=',fieldEnd-field));
+        if (separator){
+            sSlice key = trimmed(sSlice(field,separator-field));
+            sSlice value(separator+1,fieldEnd-separator-1);
+            if (key.equals("PREFIX"))
+                prefix = trimmed(value);
+            else
+            if (key.equals("VERSION"))
+                version = trimmed(value);
+            else
+            if (key.equals("STATE"))
+                state = value;
+            else
+            if (key.equals("APP_FILENAME"))
+                appFileName = value;
             else
-                break;
-            i++;
+            if (key.equals("USER_INACTIVE_TIME"))
+                inactiveTime = value;
+            else
+            if (key.startsWith("APP_")){
+                int index = toInt(sSlice(key.data+4,key.size-4));
+                if (index>0 && index<=size){
+                    if (apps.size()<index)
+                        apps.resize(index);
+                    apps[index-1] = value;
+                }
+            }
         }
+        field = fieldEnd+1;
+    }
+
+    if (!version.equals(EXTERNAL_TRACKER_FORMAT_VERSION)){
+        qWarning() << "unknown exterinal tracker with VERSION=" << QByteArray(version.data,version.size);
+        return false;
+    }
+
+    QString stateValue = decoded(state);
+    if (stateValue.isEmpty()){
+        //qWarning() << "external tracker state is empty";
+        return true;
+    }
+
+    if (prefix.equals(EXTERNAL_TRACKER_PREFIX)){
+        //numbers go one by one, first missed ends list
+        for (int i = 0; i<apps.size() && !apps[i].isNull(); i++)
+            addPair(decoded(apps[i]).toUpper(),stateValue);
     }
     else
-    if (pairs["PREFIX"].compare(OVERRIDE_TRACKER_PREFIX)==0){
-        if (!pairs.contains("APP_FILENAME")){
+    if (prefix.equals(OVERRIDE_TRACKER_PREFIX)){
+        if (appFileName.isNull()){
             qWarning() << "override tracker APP_FILENAME not defined";
-            return;
+            return false;
         }
-        if (!pairs.contains("USER_INACTIVE_TIME")){
+        if (inactiveTime.isNull()){
             qWarning() << "override tracker USER_INACTIVE_TIME not defined";
-            return;
+            return false;
         }
 
-        addOverride(pairs["APP_FILENAME"],pairs["STATE"],pairs["USER_INACTIVE_TIME"].toInt());
+        addOverride(decoded(appFileName),stateValue,toInt(inactiveTime));
     }
     else{
-        qWarning() << "unknown exterinal tracker with PREFIX=" << pairs["PREFIX"];
+        qWarning() << "unknown exterinal tracker with PREFIX=" << QByteArray(prefix.data,prefix.size);
+        return false;
     }
-
-
+    return true;
 }
 
 
-cHTTPTrackerServer::cHTTPTrackerServer(int port)
+cHTTPTrackerServer::cHTTPTrackerServer(int port):
+    m_ConnectionsCount(0)
 {
     if (!listen(QHostAddress::Any,port)){
         qCritical() << "http server start error: " << errorString();
@@ -208,8 +488,23 @@ cHTTPTrackerServer::cHTTPTrackerServer(int port)
 
 void cHTTPTrackerServer::incomingConnection(qintptr handle)
 {
-    QTcpSocket* socket = new QTcpSocket();
-    socket->setSocketDescriptor(handle);
+    QTcpSocket* socket = new QTcpSocket(this);
+    if (!socket->setSocketDescriptor(handle)){
+        delete socket;
+        return;
+    }
+
+    if (m_ConnectionsCount>=MAX_CONNECTIONS){
+        connect(socket,SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        writeResponse(socket,"503 Service Unavailable",false);
+        return;
+    }
+    m_ConnectionsCount++;
+
+    QTimer* idleTimer = new QTimer(socket);
+    idleTimer->setSingleShot(true);
+    idleTimer->start(IDLE_TIMEOUT_MS);
+    connect(idleTimer,SIGNAL(timeout()), this, SLOT(onIdleTimeout()));
 
     connect(socket,SIGNAL(readyRead()), this, SLOT(onReadyRead()));
     connect(socket,SIGNAL(disconnected()), this, SLOT(onDisconnected()));
@@ -218,27 +513,129 @@ void cHTTPTrackerServer::incomingConnection(qintptr handle)
 void cHTTPTrackerServer::onReadyRead()
 {
     QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    QTimer* idleTimer = socket->findChild<QTimer*>();
+    if (idleTimer)
+        idleTimer->start(IDLE_TIMEOUT_MS);
+
+    //pipelined requests are answered in order they came
+    while (socket->state()==QAbstractSocket::ConnectedState && processRequest(socket));
+}
 
-    QString data = socket->readAll();
-    data = data.split("\r")[0];
-    int dataPos = data.indexOf("?");
-    if (dataPos>-1){
-        data = data.mid(dataPos+1);
-        dataPos = data.indexOf(" ");
-        if (dataPos>-1){
-            data = data.mid(0,dataPos);
-            emit dataReady(data);
+//value of header line if its name matches, names are case insensitive
+static bool headerValue(const QByteArray& line, const char* name, QByteArray& value)
+{
+    int colon = line.indexOf(':');
+    if (colon<0 || line.left(colon).trimmed().toLower()!=name)
+        return false;
+    value = line.mid(colon+1).trimmed().toLower();
+    return true;
+}
+
+bool cHTTPTrackerServer::processRequest(QTcpSocket *socket)
+{
+    //request stays in socket buffer until it is received completely
+    const QByteArray pending = socket->peek(MAX_REQUEST_SIZE);
+    int headersEnd = pending.indexOf("\r\n\r\n");
+    if (headersEnd<0){
+        if (pending.size()>=MAX_REQUEST_SIZE)
+            writeResponse(socket,"431 Request Header Fields Too Large",false);
+        return false;
+    }
+
+    const QList<QByteArray> lines = pending.left(headersEnd).split('\n');
+    const QList<QByteArray> requestLine = lines[0].trimmed().split(' ');
+    if (requestLine.size()!=3 || !requestLine[2].startsWith("HTTP/1.")){
+        writeResponse(socket,"400 Bad Request",false);
+        return false;
+    }
+    const QByteArray& method = requestLine[0];
+    const QByteArray& target = requestLine[1];
+    //1.1 connections are persistent by default, 1.0 only if asked
+    bool keepAlive = requestLine[2]!="HTTP/1.0";
+    qint64 contentLength = 0;
+
+    QByteArray value;
+    for (int i = 1; i<lines.size(); i++){
+        if (headerValue(lines[i],"content-length",value)){
+            bool ok = false;
+            contentLength = value.toLongLong(&ok);
+            if (!ok || contentLength<0){
+                writeResponse(socket,"400 Bad Request",false);
+                return false;
+            }
+        }
+        else
+        if (headerValue(lines[i],"connection",value)){
+            if (value.contains("close"))
+                keepAlive = false;
+            else
+            if (value.contains("keep-alive"))
+                keepAlive = true;
         }
+        else
+        if (headerValue(lines[i],"transfer-encoding",value)){
+            writeResponse(socket,"411 Length Required",false);
+            return false;
+        }
+    }
+
+    const qint64 requestSize = headersEnd+4+contentLength;
+    if (requestSize>MAX_REQUEST_SIZE){
+        writeResponse(socket,"413 Payload Too Large",false);
+        return false;
+    }
+    if (pending.size()<requestSize)
+        return false;
+    socket->read(requestSize);
+
+    if (method=="OPTIONS"){
+        //CORS preflight of extensions
+        writeResponse(socket,"204 No Content",keepAlive);
+        return keepAlive;
+    }
+    if (method!="GET" && method!="POST"){
+        writeResponse(socket,"405 Method Not Allowed",keepAlive);
+        return keepAlive;
+    }
+
+    //data comes as query of url or as url encoded body
+    QByteArray data = pending.mid(headersEnd+4,contentLength);
+    if (data.isEmpty()){
+        int query = target.indexOf('?');
+        if (query>-1)
+            data = target.mid(query+1);
     }
+    if (!data.isEmpty())
+        emit dataReady(data);
+
+    writeResponse(socket,"200 OK",keepAlive);
+    return keepAlive;
+}
 
-    QString response = "HTTP/1.1 200 OK";
-    socket->write(response.toUtf8());
-    socket->disconnectFromHost();
+void cHTTPTrackerServer::writeResponse(QTcpSocket *socket, const char *status, bool keepAlive)
+{
+    QByteArray response = "HTTP/1.1 ";
+    response += status;
+    response += "\r\nContent-Length: 0"
+                "\r\nAccess-Control-Allow-Origin: *"
+                "\r\nAccess-Control-Allow-Methods: GET, POST, OPTIONS";
+    response += keepAlive?"\r\nConnection: keep-alive\r\n\r\n":"\r\nConnection: close\r\n\r\n";
+    socket->write(response);
+    if (!keepAlive)
+        socket->disconnectFromHost();
 }
 
 void cHTTPTrackerServer::onDisconnected()
 {
     QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender());
+    m_ConnectionsCount--;
     socket->close();
     socket->deleteLater();
 }
+
+void cHTTPTrackerServer::onIdleTimeout()
+{
+    QTcpSocket* socket = qobject_cast<QTcpSocket*>(sender()->parent());
+    if (socket)
+        socket->disconnectFromHost();
+}
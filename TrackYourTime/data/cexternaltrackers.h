@@ -24,36 +24,66 @@
 #include <QDataStream>
 #include <QTcpServer>
 #include <QTcpSocket>
+#include <QElapsedTimer>
 #include <QDataStream>
+#include <QHash>
 #include "../tools/os_api.h"
 
 struct sExternalTrackerPair{
-    QString HostAppFileName;
     QString ClientState;
-    int LifeTime;    
+    qint64 ExpireTime; //ms of tracker clock
 };
 
 struct sOverrideTrackerInfo{
     QString AppFileName;
     QString State;
-    int IdleTime;
-    int LifeTime;
+    int IdleTime; //seconds, counted from IdleSince when tracker is requested
+    qint64 IdleSince; //ms of tracker clock, last user input on client
+    qint64 ExpireTime; //ms of tracker clock
 };
 
+//last applied packet of binary protocol sender, forgotten together with its records
+struct sTrackerSender{
+    quint64 Sequence;
+    qint64 ExpireTime; //ms of tracker clock
+};
+
+//HTTP/1.1 endpoint for browser extensions. connections are kept alive, requests may be pipelined and come by parts
 class cHTTPTrackerServer: public QTcpServer
 {
     Q_OBJECT
 public:
+    static const int    MAX_CONNECTIONS = 32;
+    static const int    MAX_REQUEST_SIZE = 16*1024; //headers and body
+    static const int    IDLE_TIMEOUT_MS = 30000;
+
     cHTTPTrackerServer(int port);
 
     virtual void incomingConnection(qintptr handle) override;
+protected:
+    int                 m_ConnectionsCount;
+    //false if request is not fully received yet or connection is closed after it
+    bool processRequest(QTcpSocket* socket);
+    void writeResponse(QTcpSocket* socket, const char* status, bool keepAlive);
 signals:
-    void dataReady(QString data);
+    void dataReady(QByteArray data);
 protected slots:
     void onReadyRead();
     void onDisconnected();
+    void onIdleTimeout();
 };
 
+/*
+ * Binary protocol, version 2. All numbers are varints(see cByteBin), strings are varuint size + utf8.
+ *   "TYT2" version kind sender sequence sendTime userName count record*count
+ *   record: app state idleTime time
+ * kind - 1 for external trackers, 2 for override trackers. sender is random id of sending instance,
+ * sequence grows by one for every packet of sender, so lost packets are counted and late ones are dropped.
+ * times are ms of sender clock, only differences between them are used.
+ * optional trailer: lifeTime - seconds records are valid without refresh, clamped by receiver. 0 or missed - default.
+ * unknown trailing data is ignored.
+ * Text protocol of version 1 is still accepted. Client mode sends it by default, older hosts don't read binary.
+ */
 class cExternalTrackers : public QObject
 {
     Q_OBJECT
@@ -62,29 +92,81 @@ public:
     static const int    EXTERNAL_TRACKERS_HTTP_PORT = 25856;
     static const int    EXTERNAL_TRACKERS_PAIR_LIFE_TIME_SECOND = 5;
     static const int    OVERRIDE_TRACKERS_PAIR_LIFE_TIME_SECOND = 4;
+    static const int    MAX_OVERRIDE_TRACKERS_LIFE_TIME_SECOND = 120;
+    //client mode sends state on change only. host extrapolates client idle time, it is corrected when error is too big
+    static const int    CLIENT_TRACKER_LIFE_TIME_SECOND = 45;
+    static const int    CLIENT_HEARTBEAT_SECOND = CLIENT_TRACKER_LIFE_TIME_SECOND/3;
+    //text packets have no lifetime, host drops them after OVERRIDE_TRACKERS_PAIR_LIFE_TIME_SECOND
+    static const int    CLIENT_TEXT_HEARTBEAT_SECOND = OVERRIDE_TRACKERS_PAIR_LIFE_TIME_SECOND/2;
+    static const int    CLIENT_IDLE_TOLERANCE_SECOND = 10;
+    static const int    RECEIVE_BUFFER_SIZE = 2048; //grows for larger datagrams
+    static const int    BINARY_FORMAT_VERSION = 2;
+    enum eBinaryPacketKind{
+        BPK_EXTERNAL_TRACKERS = 1,
+        BPK_OVERRIDE_TRACKERS
+    };
 protected:
+    QElapsedTimer       m_Clock; //records expire by time, not by count of updates
     QUdpSocket          m_Client;
+    QString             m_UserName; //sent with every override packet, read once
+    quint32             m_SenderId;
+    quint32             m_SendSequence;
+    //last sent state of client mode
+    QString             m_SentApp;
+    QString             m_SentState;
+    QString             m_SentHost;
+    bool                m_SentBinary;
+    int                 m_SentIdleTime;
+    qint64              m_SentTime; //-1 if nothing was sent
 
     QUdpSocket          m_Server;    
     cHTTPTrackerServer  m_HTTPServer;
-    QVector<sOverrideTrackerInfo> m_Override;
-    QVector<sExternalTrackerPair> m_Pairs;
-    void addPair(const QString& AppName, const QString& CurrentState);
-    void addOverride(const QString& AppName, const QString& CurrentState, int idleTime);
+    QByteArray          m_ReceiveBuffer; //reused by all datagrams
+    int                 m_ReceivedCount;
+    int                 m_DroppedCount;
+    int                 m_MalformedCount;
+    int                 m_LostCount; //gaps in sequences of binary packets
+    QHash<quint64,sTrackerSender> m_Senders; //by sender id
+    bool                m_InBatch;
+    bool                m_BatchChanged;
+    void notifyChanged();
+
+    QHash<QString,sOverrideTrackerInfo> m_Override; //by upcase app name
+    QHash<QString,sExternalTrackerPair> m_Pairs; //by upcase app name
+    //age - ms record waited at sender before it was sent
+    void addPair(const QString& AppName, const QString& CurrentState, qint64 age = 0);
+    void addOverride(const QString& AppName, const QString& CurrentState, int idleTime, qint64 age = 0, int lifeTime = OVERRIDE_TRACKERS_PAIR_LIFE_TIME_SECOND);
+    //binary or text message. false for malformed message
+    bool parsePacket(const char* data, int size);
+    //parses message in place, only values which are used are decoded
+    bool parseMessage(const char* data, int size);
+    bool parseBinaryMessage(const char* data, int size);
 public:
     explicit cExternalTrackers(QObject *parent = 0);
 
+    //kernel buffer for datagrams coming between two reads
+    void setReceiveBufferSize(int bytes);
+    int receivedCount(){return m_ReceivedCount;}
+    int droppedCount(){return m_DroppedCount;}
+    int malformedCount(){return m_MalformedCount;}
+    int lostCount(){return m_LostCount;}
+
+    //drops expired records
     void update();
+    bool hasOverrideTrackers(){return !m_Override.isEmpty();}
 
     bool getExternalTrackerState(const QString &appName, QString& outValue);
     sOverrideTrackerInfo* getOverrideTracker();
 
-    void sendOverrideTracker(const QString& AppName, const QString& CurrentState, int idleTime, const QString& host);
+    //called every sample, packet is sent only if state changed or heartbeat is due.
+    //binary - host is known to read protocol of version 2, otherwise text protocol of version 1 is used
+    void sendOverrideTracker(const QString& AppName, const QString& CurrentState, int idleTime, const QString& host, bool binary);
 signals:
-
+    //new tracker or state of known one is changed
+    void trackersChanged();
 public slots:
     void readyRead();
-    void onDataReady(QString data);
+    void onDataReady(QByteArray data);
 };
 
 #endif // CEXTERNALTRACKERS_H
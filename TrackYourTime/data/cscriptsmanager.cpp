@@ -104,86 +104,239 @@ QString cScriptsManager::evaluteCustomScript(const sSysInfo &info, QString scrip
 */
 
 
-cScriptsManager::cScriptsManager(QObject *parent) : QJSEngine(parent)
+uint qHash(const sScriptCallKey &key, uint seed)
 {
-
+    return qHash(key.application,seed) ^ qHash(key.title,seed) ^ qHash(key.prevStepResult,seed) ^ key.scriptId;
 }
 
-QString cScriptsManager::getAppInfo(const sSysInfo &info,QString script)
-{
-    QJSValue result = evalute(info, script);
-    if (result.isError()){
-        qCritical() << "script execution for app " << info.fileName << "failed with exception: " << result.toString();
-        return "";
-    }
-    if (result.toString()=="undefined"){
-        qCritical() << "script execution for app " << info.fileName << "failed. no result returned";
-        return "";
-    }
-    return result.toString().trimmed();
-}
-
-QJSValue cScriptsManager::evalute(const sSysInfo &info, QString script)
+static QString currentOS()
 {
-    QString OS = "UNKNOWN";
 #ifdef Q_OS_LINUX
-    OS = "LINUX";
+    return "LINUX";
 #else
     #ifdef Q_OS_WIN32
-        OS = "WINDOWS";
+        return "WINDOWS";
     #else
         #ifdef Q_OS_MAC
-            OS = "MAC_OS_X";
+            return "MAC_OS_X";
         #endif
     #endif
 #endif
+    return "UNKNOWN";
+}
 
+cScriptWatchdog::cScriptWatchdog(QJSEngine *engine) : QThread(),
+    m_Engine(engine),
+    m_Deadline(-1),
+    m_Fired(false),
+    m_Stop(false)
+{
+    m_Clock.start();
+}
 
-    QJSValue fun = evaluate(script);
-    if (fun.isError())
-        return fun;
-    QJSValueList args;
-    args << info.fileName << info.title << OS;
-    QJSValue result = globalObject().property("parseTitle").call(args);
-    return result;
+cScriptWatchdog::~cScriptWatchdog()
+{
+    m_Mutex.lock();
+    m_Stop = true;
+    m_Changed.wakeAll();
+    m_Mutex.unlock();
+    wait();
 }
 
-QString cScriptsManager::processCustomScript(const sSysInfo &info,QString script, QString prevStepResult)
+void cScriptWatchdog::run()
 {
-    QJSValue result = evaluteCustomScript(info, script,prevStepResult);
-    if (result.isError()){
-        qCritical() << "script execution for app " << info.fileName << "failed with exception: " << result.toString();
-        return "";
-    }
-    if (result.toString()=="undefined"){
-        qCritical() << "script execution for app " << info.fileName << "failed. no result returned";
-        return "";
+    QMutexLocker locker(&m_Mutex);
+    while (!m_Stop){
+        if (m_Deadline<0){
+            m_Changed.wait(&m_Mutex);
+            continue;
+        }
+        qint64 left = m_Deadline-m_Clock.elapsed();
+        if (left>0){
+            m_Changed.wait(&m_Mutex,(unsigned long)left);
+            continue;
+        }
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
+        m_Engine->setInterrupted(true);
+#endif
+        m_Fired = true;
+        m_Deadline = -1;
     }
-    return result.toString().trimmed();
 }
 
-QJSValue cScriptsManager::evaluteCustomScript(const sSysInfo &info, QString script, QString prevStepResult)
+void cScriptWatchdog::arm(int budget)
 {
-    QString OS = "UNKNOWN";
-#ifdef Q_OS_LINUX
-    OS = "LINUX";
-#else
-    #ifdef Q_OS_WIN32
-        OS = "WINDOWS";
-    #else
-        #ifdef Q_OS_MAC
-            OS = "MAC_OS_X";
-        #endif
-    #endif
+    QMutexLocker locker(&m_Mutex);
+    m_Fired = false;
+    m_Deadline = m_Clock.elapsed()+budget;
+    m_Changed.wakeAll();
+}
+
+bool cScriptWatchdog::disarm()
+{
+    QMutexLocker locker(&m_Mutex);
+    m_Deadline = -1;
+    if (!m_Fired)
+        return false;
+    m_Fired = false;
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
+    m_Engine->setInterrupted(false);
 #endif
+    return true;
+}
 
+cScriptsManager::cScriptsManager(QObject *parent) : QJSEngine(parent),
+    m_NextScriptId(0),
+    m_ResultsHits(0),
+    m_ResultsMisses(0),
+    m_TimeBudget(0),
+    m_CallInterrupted(false)
+{
+    m_Results.setMaxCost(MAX_CACHED_RESULTS);
+    m_Watchdog = new cScriptWatchdog(this);
+    m_Watchdog->start();
+}
 
-    QJSValue fun = evaluate(script);
-    if (fun.isError())
+cScriptsManager::~cScriptsManager()
+{
+    delete m_Watchdog;
+}
+
+QJSValue cScriptsManager::guardedCall(QJSValue function, const QJSValueList &args, const QString &application)
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (m_TimeBudget>0)
+        m_Watchdog->arm(m_TimeBudget);
+    QJSValue result = function.call(args);
+    //deadline may pass after script returned, its result is still valid then
+    m_CallInterrupted = m_TimeBudget>0 && m_Watchdog->disarm() && result.isError();
+    qint64 us = timer.nsecsElapsed()/1000;
+
+    sScriptStatistic& stat = m_Statistic[application];
+    stat.calls++;
+    stat.totalUs+=us;
+    if (us>stat.maxUs)
+        stat.maxUs = us;
+    if (m_CallInterrupted){
+        stat.timeouts++;
+        qWarning() << "script for app " << application << "was stopped after" << us/1000 << "ms";
+    }
+    return result;
+}
+
+QJSValue cScriptsManager::guardedEvaluate(const QString &program)
+{
+    //endless loop may be at top level of script too
+    if (m_TimeBudget>0)
+        m_Watchdog->arm(m_TimeBudget);
+    QJSValue result = evaluate(program);
+    m_CallInterrupted = m_TimeBudget>0 && m_Watchdog->disarm() && result.isError();
+    return result;
+}
+
+sCompiledScript cScriptsManager::compiledFunction(QHash<QString, sCompiledScript> &cache, const QString &script, const QString &functionName)
+{
+    m_CallInterrupted = false;
+    QHash<QString,sCompiledScript>::const_iterator it = cache.constFind(script);
+    if (it!=cache.constEnd())
+        return it.value();
+
+    //script is compiled once. wrapper is on first line, so line numbers in errors stay the same
+    sCompiledScript compiled;
+    compiled.function = guardedEvaluate("(function(){"+script+"\nreturn "+functionName+";})()");
+    if (m_CallInterrupted){
+        //not cached, script will be compiled again next time
+        compiled.function = QJSValue(QJSValue::UndefinedValue);
+        compiled.id = 0;
+        return compiled;
+    }
+    if (!compiled.function.isError() && !compiled.function.isCallable())
+        compiled.function = QJSValue(QJSValue::UndefinedValue);
+    //new id for every compilation, so results of replaced script are never returned
+    compiled.id = ++m_NextScriptId;
+    if (cache.size()>=MAX_COMPILED_SCRIPTS)
+        cache.clear();
+    cache.insert(script,compiled);
+    return compiled;
+}
+
+QString cScriptsManager::cachedCall(const sCompiledScript &compiled, const sSysInfo &info, const QString &prevStepResult, bool customScript)
+{
+    if (m_CallInterrupted) //compilation was stopped
+        return QString();
+    const sScriptCallKey key = {compiled.id, info.fileName, info.title, prevStepResult};
+    QString* cached = m_Results.object(key);
+    if (cached){
+        m_ResultsHits++;
+        return *cached;
+    }
+    m_ResultsMisses++;
+
+    QJSValue result = customScript?callDataParser(compiled,info,prevStepResult):callTitleParser(compiled,info);
+    if (m_CallInterrupted)
+        return QString();
+    QString value;
+    if (result.isError())
+        qCritical() << "script execution for app " << info.fileName << "failed with exception: " << result.toString();
+    else
+    if (result.toString()=="undefined")
+        qCritical() << "script execution for app " << info.fileName << "failed. no result returned";
+    else
+        value = result.toString().trimmed();
+    m_Results.insert(key,new QString(value));
+    return value;
+}
+
+QJSValue cScriptsManager::callTitleParser(const sCompiledScript &compiled, const sSysInfo &info)
+{
+    QJSValue fun = compiled.function;
+    if (!fun.isCallable())
         return fun;
     QJSValueList args;
-    args << info.fileName << info.title << prevStepResult << OS;
-    QJSValue result = globalObject().property("parseData").call(args);
+    args << info.fileName << info.title << currentOS();
+    return guardedCall(fun,args,info.fileName);
+}
 
-    return result;
+QJSValue cScriptsManager::callDataParser(const sCompiledScript &compiled, const sSysInfo &info, const QString &prevStepResult)
+{
+    QJSValue fun = compiled.function;
+    if (!fun.isCallable())
+        return fun;
+    QJSValueList args;
+    args << info.fileName << info.title << prevStepResult << currentOS();
+    return guardedCall(fun,args,info.fileName);
+}
+
+void cScriptsManager::releaseScript(const QString &script)
+{
+    m_TitleParsers.remove(script);
+    m_DataParsers.remove(script);
+}
+
+void cScriptsManager::clearCompiledScripts()
+{
+    m_TitleParsers.clear();
+    m_DataParsers.clear();
+    m_Results.clear();
+}
+
+QString cScriptsManager::getAppInfo(const sSysInfo &info,QString script)
+{
+    return cachedCall(compiledFunction(m_TitleParsers,script,"parseTitle"),info,QString(),false);
+}
+
+QJSValue cScriptsManager::evalute(const sSysInfo &info, QString script)
+{
+    return callTitleParser(compiledFunction(m_TitleParsers,script,"parseTitle"),info);
+}
+
+QString cScriptsManager::processCustomScript(const sSysInfo &info,QString script, QString prevStepResult)
+{
+    return cachedCall(compiledFunction(m_DataParsers,script,"parseData"),info,prevStepResult,true);
+}
+
+QJSValue cScriptsManager::evaluteCustomScript(const sSysInfo &info, QString script, QString prevStepResult)
+{
+    return callDataParser(compiledFunction(m_DataParsers,script,"parseData"),info,prevStepResult);
 }
@@ -42,11 +42,103 @@ public slots:
 
 #include <QJSEngine>
 #include <QJSValue>
+#include <QHash>
+#include <QCache>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QElapsedTimer>
+
+struct sCompiledScript{
+    QJSValue function;
+    int id;
+};
+
+//one call of parse function. scripts are expected to depend only on arguments
+struct sScriptCallKey{
+    int scriptId;
+    QString application;
+    QString title;
+    QString prevStepResult;
+    bool operator==(const sScriptCallKey& other) const {
+        return scriptId==other.scriptId && application==other.application && title==other.title && prevStepResult==other.prevStepResult;
+    }
+};
+uint qHash(const sScriptCallKey& key, uint seed = 0);
+
+struct sScriptStatistic{
+    int calls;
+    int timeouts;
+    qint64 totalUs;
+    qint64 maxUs;
+    sScriptStatistic():calls(0),timeouts(0),totalUs(0),maxUs(0){}
+};
+
+//interrupts engine when script runs longer than allowed. engine thread is never blocked by it
+class cScriptWatchdog : public QThread
+{
+    Q_OBJECT
+protected:
+    QJSEngine*          m_Engine;
+    QMutex              m_Mutex;
+    QWaitCondition      m_Changed;
+    QElapsedTimer       m_Clock;
+    qint64              m_Deadline; //-1 when no script is running
+    bool                m_Fired;
+    bool                m_Stop;
+    void run() override;
+public:
+    explicit cScriptWatchdog(QJSEngine* engine);
+    ~cScriptWatchdog();
+
+    void arm(int budget);
+    //returns true if deadline passed. script which returned before it has valid result, interrupted one returns error
+    bool disarm();
+};
+
 class cScriptsManager : public QJSEngine
 {
     Q_OBJECT
+protected:
+    static const int    MAX_COMPILED_SCRIPTS = 64;
+    static const int    MAX_CACHED_RESULTS = 1024;
+
+    //script text -> parse function compiled from it. every script gets own scope, so helpers of scripts don't clash
+    QHash<QString,sCompiledScript> m_TitleParsers;
+    QHash<QString,sCompiledScript> m_DataParsers;
+    int                 m_NextScriptId;
+    sCompiledScript compiledFunction(QHash<QString,sCompiledScript>& cache, const QString& script, const QString& functionName);
+
+    //least recently used results, stable window doesn't run scripts at all
+    QCache<sScriptCallKey,QString> m_Results;
+    int                 m_ResultsHits;
+    int                 m_ResultsMisses;
+    QString cachedCall(const sCompiledScript& compiled, const sSysInfo &info, const QString& prevStepResult, bool customScript);
+
+    QJSValue callTitleParser(const sCompiledScript& compiled, const sSysInfo &info);
+    QJSValue callDataParser(const sCompiledScript& compiled, const sSysInfo &info, const QString& prevStepResult);
+
+    cScriptWatchdog*    m_Watchdog;
+    int                 m_TimeBudget; //ms, 0 - unlimited
+    bool                m_CallInterrupted;
+    QHash<QString,sScriptStatistic> m_Statistic; //by application, compiled scripts are replaced and dropped
+    QJSValue guardedCall(QJSValue function, const QJSValueList& args, const QString& application);
+    QJSValue guardedEvaluate(const QString& program);
 public:
     explicit cScriptsManager(QObject *parent = 0);
+    ~cScriptsManager();
+
+    void setTimeBudget(int ms){m_TimeBudget = ms;}
+    //last script call was stopped by time budget, its result is not valid
+    bool isCallInterrupted(){return m_CallInterrupted;}
+    const QHash<QString,sScriptStatistic>& statistic(){return m_Statistic;}
+
+    //drops compiled function of script which is not used anymore
+    void releaseScript(const QString& script);
+    void clearCompiledScripts();
+
+    int resultsHits(){return m_ResultsHits;}
+    int resultsMisses(){return m_ResultsMisses;}
 
     QString getAppInfo(const sSysInfo &info, QString script);
     QJSValue evalute(const sSysInfo& info, QString script);
@@ -0,0 +1,164 @@
+/*
+ * TrackYourTime - cross-platform time tracker
+ * Copyright (C) 2015-2017  Alexander Basov <basovav@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "cstatisticengine.h"
+#include <QtConcurrent>
+#include <QElapsedTimer>
+
+cStatisticEngine::cStatisticEngine(QObject *parent) : QObject(parent),m_Generation(0)
+{
+    qRegisterMetaType<sStatisticResult>("sStatisticResult");
+    //queries are executed one by one, canceled query leaves at next application.
+    //every query is split to shards calculated on all cores
+    m_Pool.setMaxThreadCount(1);
+    m_ShardsPool.setMaxThreadCount(QThread::idealThreadCount());
+}
+
+cStatisticEngine::~cStatisticEngine()
+{
+    cancel();
+    m_Pool.waitForDone();
+    m_ShardsPool.waitForDone();
+}
+
+sStatisticQuery cStatisticEngine::makeQuery(cDataManager *DataManager, qint64 fromDay, qint64 toDay)
+{
+    sStatisticQuery query;
+    query.fromDay = fromDay;
+    query.toDay = toDay;
+    query.categoriesCount = DataManager->categoriesCount();
+    query.applications.resize(DataManager->applicationsCount());
+    for (int i = 0; i<query.applications.size(); i++)
+        query.applications[i] = DataManager->applications(i)->activities;
+    return query;
+}
+
+int cStatisticEngine::start(const sStatisticQuery &query)
+{
+    int id = m_Generation.fetchAndAddOrdered(1)+1;
+    QtConcurrent::run(&m_Pool,this,&cStatisticEngine::run,id,query);
+    return id;
+}
+
+void cStatisticEngine::cancel()
+{
+    m_Generation.fetchAndAddOrdered(1);
+}
+
+sStatisticResult cStatisticEngine::calcShard(const sStatisticShard &shard)
+{
+    //partial sums for own range of applications, merged by query thread
+    sStatisticResult result;
+    result.totalTime = 0;
+    result.uncategorized = 0;
+    result.processedApplications = 0;
+    result.categories.fill(0,shard.query->categoriesCount);
+    result.applications.fill(0,shard.lastApplication-shard.firstApplication);
+    result.activities.resize(result.applications.size());
+
+    for (int i = 0; i<result.applications.size(); i++){
+        if (shard.engine->isCanceled(shard.id))
+            return result;
+        const QVector<sActivityInfo>& activities = shard.query->applications[shard.firstApplication+i];
+        result.activities[i].fill(0,activities.size());
+        for (int activity = 0; activity<activities.size(); activity++){
+            const sActivityInfo& ainfo = activities[activity];
+            //sum per day aggregates, periods are already split at local midnight
+            QMap<qint64, QVector<int> >::const_iterator day = ainfo.days.lowerBound(shard.query->fromDay);
+            for (; day!=ainfo.days.constEnd() && day.key()<=shard.query->toDay; ++day){
+                const QVector<int>& profiles = day.value();
+                for (int profile = 0; profile<profiles.size(); profile++){
+                    int duration = profiles[profile];
+                    if (duration==0)
+                        continue;
+                    result.totalTime+=duration;
+                    result.applications[i]+=duration;
+                    result.activities[i][activity]+=duration;
+                    int cat = profile<ainfo.categories.size()?ainfo.categories[profile].category:-1;
+                    if (cat<0 || cat>=result.categories.size())
+                        result.uncategorized+=duration;
+                    else
+                        result.categories[cat]+=duration;
+                }
+            }
+        }
+        result.processedApplications = i+1;
+    }
+
+    return result;
+}
+
+void cStatisticEngine::run(int id, sStatisticQuery query)
+{
+    if (isCanceled(id))
+        return;
+
+    sStatisticResult result;
+    result.totalTime = 0;
+    result.uncategorized = 0;
+    result.processedApplications = 0;
+    result.categories.fill(0,query.categoriesCount);
+    result.applications.fill(0,query.applications.size());
+    result.activities.resize(query.applications.size());
+
+    int shardsCount = qMax(1,qMin(query.applications.size(),m_ShardsPool.maxThreadCount()*SHARDS_PER_THREAD));
+    QVector<sStatisticShard> shards(shardsCount);
+    for (int i = 0; i<shardsCount; i++){
+        shards[i].engine = this;
+        shards[i].id = id;
+        shards[i].query = &query;
+        shards[i].firstApplication = query.applications.size()*i/shardsCount;
+        shards[i].lastApplication = query.applications.size()*(i+1)/shardsCount;
+    }
+
+    QVector<QFuture<sStatisticResult> > futures(shardsCount);
+    for (int i = 0; i<shardsCount; i++)
+        futures[i] = QtConcurrent::run(&m_ShardsPool,&cStatisticEngine::calcShard,shards[i]);
+
+    QElapsedTimer progressTimer;
+    progressTimer.start();
+
+    //merge shards in order, results of finished shards are shown while others are still running
+    for (int i = 0; i<shardsCount; i++){
+        if (isCanceled(id)){
+            //shards check generation too, wait them to release query
+            for (int j = i; j<shardsCount; j++)
+                futures[j].waitForFinished();
+            return;
+        }
+        const sStatisticResult shardResult = futures[i].result();
+        result.totalTime+=shardResult.totalTime;
+        result.uncategorized+=shardResult.uncategorized;
+        for (int cat = 0; cat<result.categories.size(); cat++)
+            result.categories[cat]+=shardResult.categories[cat];
+        for (int app = 0; app<shardResult.applications.size(); app++){
+            result.applications[shards[i].firstApplication+app] = shardResult.applications[app];
+            result.activities[shards[i].firstApplication+app] = shardResult.activities[app];
+        }
+        result.processedApplications = shards[i].lastApplication;
+
+        if (progressTimer.elapsed()>=PROGRESS_INTERVAL && i+1<shardsCount){
+            progressTimer.restart();
+            emit progress(id,result);
+        }
+    }
+
+    if (isCanceled(id))
+        return;
+    emit finished(id,result);
+}
@@ -0,0 +1,95 @@
+/*
+ * TrackYourTime - cross-platform time tracker
+ * Copyright (C) 2015-2017  Alexander Basov <basovav@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CSTATISTICENGINE_H
+#define CSTATISTICENGINE_H
+
+#include <QObject>
+#include <QVector>
+#include <QAtomicInt>
+#include <QThreadPool>
+#include "cdatamanager.h"
+
+/*
+ * Immutable copy of period data used by statistic worker.
+ * Activities are implicitly shared, so taking snapshot costs one reference per application,
+ * tracking continues to modify own copy while report is being calculated.
+ */
+struct sStatisticQuery{
+    qint64 fromDay;
+    qint64 toDay;
+    int categoriesCount;
+    QVector<QVector<sActivityInfo> > applications;
+};
+
+struct sStatisticResult{
+    int totalTime;
+    int uncategorized;
+    QVector<int> categories;
+    QVector<int> applications;
+    QVector<QVector<int> > activities;
+    int processedApplications;
+};
+
+Q_DECLARE_METATYPE(sStatisticResult)
+
+class cStatisticEngine;
+
+//contiguous range of applications aggregated by one pool thread
+struct sStatisticShard{
+    cStatisticEngine* engine;
+    int id;
+    const sStatisticQuery* query;
+    int firstApplication;
+    int lastApplication;
+};
+
+class cStatisticEngine : public QObject
+{
+    Q_OBJECT
+protected:
+    static const int    PROGRESS_INTERVAL = 100; //ms between partial results
+    static const int    SHARDS_PER_THREAD = 4; //more shards than threads keep cores busy when applications are uneven
+
+    QThreadPool         m_Pool;
+    QThreadPool         m_ShardsPool;
+    QAtomicInt          m_Generation;
+
+    void run(int id, sStatisticQuery query);
+    static sStatisticResult calcShard(const sStatisticShard& shard);
+public:
+    bool isCanceled(int id){return m_Generation.load()!=id;}
+
+    explicit cStatisticEngine(QObject *parent = 0);
+    ~cStatisticEngine();
+
+    //caller holds data lock of DataManager
+    static sStatisticQuery makeQuery(cDataManager* DataManager, qint64 fromDay, qint64 toDay);
+
+    //starts new query and cancels one in flight, returns query id
+    int start(const sStatisticQuery& query);
+    void cancel();
+
+    //limits threads used by shards, idealThreadCount by default
+    void setMaxThreadCount(int count){m_ShardsPool.setMaxThreadCount(count);}
+signals:
+    void progress(int id, sStatisticResult result);
+    void finished(int id, sStatisticResult result);
+};
+
+#endif // CSTATISTICENGINE_H
@@ -123,7 +123,7 @@ int main(int argc, char *argv[])
     qDebug() << "init statistic window\n";
     StatisticWindow statisticWindow(&datamanager);
     QObject::connect(&trIcon, SIGNAL(showStatistic()), &statisticWindow, SLOT(showAndUpdate()));
-    QObject::connect(&datamanager, SIGNAL(statisticFastUpdate(int,int,int,int,bool)), &statisticWindow, SLOT(fastUpdate(int,int,int,int,bool)));
+    QObject::connect(&datamanager, SIGNAL(statisticFastUpdate(int,int,int,int,bool,int)), &statisticWindow, SLOT(fastUpdate(int,int,int,int,bool,int)));
 
     qDebug() << "init about window\n";
     AboutWindow aboutWindow;
@@ -18,31 +18,152 @@
 
 #include "cfilebin.h"
 
-int cFileBin::readInt()
+cFileBin::~cFileBin()
 {
-    int value;
-    read(reinterpret_cast<char*>(&value), sizeof(int));
-    return value;
+    flushWriteBuffer();
 }
 
-uint cFileBin::readUint()
+bool cFileBin::fillReadBuffer(int size)
 {
-    uint value;
-    read(reinterpret_cast<char*>(&value), sizeof(uint));
-    return value;
+    if (buffered()>=size)
+        return true;
+    if (!m_WriteBuffer.isEmpty())
+        flushWriteBuffer();
+    //move not decoded tail to beginning and read next block after it
+    m_ReadBuffer.remove(0,m_ReadPos);
+    m_ReadPos = 0;
+    int tail = m_ReadBuffer.size();
+    m_ReadBuffer.resize(qMax(size,BUFFER_SIZE));
+    qint64 readed = m_File.read(m_ReadBuffer.data()+tail,m_ReadBuffer.size()-tail);
+    m_ReadBuffer.resize(tail+qMax(0ll,readed));
+    return buffered()>=size;
+}
+
+void cFileBin::dropReadBuffer()
+{
+    if (buffered()>0)
+        m_File.seek(m_File.pos()-buffered());
+    m_ReadBuffer.clear();
+    m_ReadPos = 0;
+}
+
+bool cFileBin::flushWriteBuffer()
+{
+    if (m_WriteBuffer.isEmpty())
+        return true;
+    bool result = m_File.write(m_WriteBuffer)==m_WriteBuffer.size();
+    m_WriteBuffer.clear();
+    return result;
+}
+
+void cFileBin::close()
+{
+    flushWriteBuffer();
+    m_ReadBuffer.clear();
+    m_ReadPos = 0;
+    m_File.close();
+}
+
+qint64 cFileBin::pos() const
+{
+    return m_File.pos()+m_WriteBuffer.size()-buffered();
+}
+
+bool cFileBin::seek(qint64 offset)
+{
+    flushWriteBuffer();
+    m_ReadBuffer.clear();
+    m_ReadPos = 0;
+    return m_File.seek(offset);
+}
+
+bool cFileBin::atEnd() const
+{
+    return buffered()==0 && m_File.atEnd();
+}
+
+qint64 cFileBin::size() const
+{
+    //not yet written data ends at current position
+    return qMax(m_File.size(),pos());
+}
+
+qint64 cFileBin::bytesAvailable() const
+{
+    return m_File.bytesAvailable()+buffered();
+}
+
+bool cFileBin::resize(qint64 sz)
+{
+    flushWriteBuffer();
+    dropReadBuffer();
+    return m_File.resize(sz);
+}
+
+bool cFileBin::flush()
+{
+    bool result = flushWriteBuffer();
+    return m_File.flush() && result;
+}
+
+qint64 cFileBin::read(char *data, qint64 maxSize)
+{
+    if (maxSize<=0)
+        return 0;
+    if (!m_WriteBuffer.isEmpty())
+        flushWriteBuffer();
+    //small reads go through buffer, big blocks are copied directly
+    if (maxSize<BUFFER_SIZE)
+        fillReadBuffer(maxSize);
+    qint64 result = qMin<qint64>(maxSize,buffered());
+    memcpy(data,m_ReadBuffer.constData()+m_ReadPos,result);
+    m_ReadPos+=result;
+    if (result<maxSize){
+        qint64 readed = m_File.read(data+result,maxSize-result);
+        if (readed>0)
+            result+=readed;
+    }
+    return result;
+}
+
+QByteArray cFileBin::read(qint64 maxSize)
+{
+    QByteArray result;
+    result.resize(qMax(0ll,qMin(maxSize,bytesAvailable())));
+    result.resize(qMax(0ll,read(result.data(),result.size())));
+    return result;
+}
+
+QByteArray cFileBin::readAll()
+{
+    return read(bytesAvailable());
+}
+
+bool cFileBin::readInts(qint32 *values, int count)
+{
+    qint64 size = (qint64)count*sizeof(qint32);
+    if (count<0 || size>bytesAvailable())
+        return false;
+    return read(reinterpret_cast<char*>(values),size)==size;
+}
+
+bool cFileBin::readUints(quint32 *values, int count)
+{
+    return readInts(reinterpret_cast<qint32*>(values),count);
 }
 
 QString cFileBin::readString()
 {
-    QString value;
     int size = readInt();
-    if (size>0){
-        char* utf8 = new char[size];
-        read(utf8,size);
-        value = QString::fromUtf8(utf8,size);
-        delete [] utf8;
+    if (size<=0)
+        return QString();
+    //decode directly from buffer, no temporary copy
+    if (size<=BUFFER_SIZE && fillReadBuffer(size)){
+        QString value = QString::fromUtf8(m_ReadBuffer.constData()+m_ReadPos,size);
+        m_ReadPos+=size;
+        return value;
     }
-    return value;
+    return QString::fromUtf8(read(size));
 }
 
 QString cFileBin::readUtf8Line()
@@ -59,14 +180,18 @@ QString cFileBin::readUtf8Line()
     return QString::fromUtf8(buffer);
 }
 
-void cFileBin::writeInt(int value)
+qint64 cFileBin::write(const char *data, qint64 size)
 {
-    write(reinterpret_cast<char*>(&value), sizeof(int));
-}
-
-void cFileBin::writeUint(uint value)
-{
-    write(reinterpret_cast<char*>(&value), sizeof(uint));
+    if (size<=0)
+        return 0;
+    if (!m_ReadBuffer.isEmpty())
+        dropReadBuffer();
+    if (m_WriteBuffer.size()+size>BUFFER_SIZE && !flushWriteBuffer())
+        return -1;
+    if (size>=BUFFER_SIZE)
+        return m_File.write(data,size);
+    m_WriteBuffer.append(data,size);
+    return size;
 }
 
 void cFileBin::writeString(const QString &value)
@@ -76,3 +201,59 @@ void cFileBin::writeString(const QString &value)
     if (data.size()>0)
         write(data.constData(),data.size());
 }
+
+QString cMemoryBin::readString()
+{
+    int size = readInt();
+    if (size<=0)
+        return QString();
+    if (size>bytesAvailable()){
+        m_Overflow = true;
+        m_Pos = m_Size;
+        return QString();
+    }
+    QString value = QString::fromUtf8(reinterpret_cast<const char*>(m_Data+m_Pos),size);
+    m_Pos+=size;
+    return value;
+}
+
+quint64 cMemoryBin::readVarUint()
+{
+    quint64 value = 0;
+    for (int shift = 0; shift<64; shift+=7){
+        if (m_Pos>=m_Size){
+            m_Overflow = true;
+            return 0;
+        }
+        uchar byte = m_Data[m_Pos++];
+        value|=static_cast<quint64>(byte&0x7F)<<shift;
+        if ((byte&0x80)==0)
+            return value;
+    }
+    //too long sequence - broken data
+    m_Overflow = true;
+    m_Pos = m_Size;
+    return 0;
+}
+
+QString cMemoryBin::readVarString()
+{
+    quint64 size = readVarUint();
+    if (size==0)
+        return QString();
+    if (size>static_cast<quint64>(bytesAvailable())){
+        m_Overflow = true;
+        m_Pos = m_Size;
+        return QString();
+    }
+    QString value = QString::fromUtf8(reinterpret_cast<const char*>(m_Data+m_Pos),static_cast<int>(size));
+    m_Pos+=size;
+    return value;
+}
+
+void cByteBin::writeVarString(const QString &value)
+{
+    QByteArray data = value.toUtf8();
+    writeVarUint(data.size());
+    m_Data.append(data);
+}
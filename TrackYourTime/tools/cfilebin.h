@@ -21,21 +21,143 @@
 
 #include <QFile>
 #include <QString>
+#include <QByteArray>
 
-class cFileBin : public QFile
+//file with own read and write buffers, so decoding db is done from memory instead of millions of small QIODevice calls.
+//QFile is owned, not inherited, so nothing reads or writes it past the buffers. it is opened unbuffered, data is buffered once
+class cFileBin
 {
-    Q_OBJECT
+protected:
+    static const int    BUFFER_SIZE = 256*1024;
+
+    QFile               m_File;
+    QByteArray          m_ReadBuffer;
+    int                 m_ReadPos;
+    QByteArray          m_WriteBuffer;
+
+    int buffered() const {return m_ReadBuffer.size()-m_ReadPos;}
+    //makes at least size bytes available in read buffer if file has them
+    bool fillReadBuffer(int size);
+    //moves file position back to first not decoded byte
+    void dropReadBuffer();
+    bool flushWriteBuffer();
 public:
-    cFileBin(const QString& FileName):QFile(FileName){}
+    cFileBin(const QString& FileName):m_File(FileName),m_ReadPos(0){}
+    ~cFileBin();
+
+    bool open(QIODevice::OpenMode mode){return m_File.open(mode|QIODevice::Unbuffered);}
+    void close();
+    bool isOpen() const {return m_File.isOpen();}
+    bool exists() const {return m_File.exists();}
+    QString fileName() const {return m_File.fileName();}
+    QFileDevice::FileError error() const {return m_File.error();}
+    QString errorString() const {return m_File.errorString();}
+    int handle() const {return m_File.handle();}
+    uchar* map(qint64 offset, qint64 size){return m_File.map(offset,size);}
+    bool unmap(uchar* address){return m_File.unmap(address);}
+
+    qint64 pos() const;
+    bool seek(qint64 offset);
+    bool atEnd() const;
+    qint64 size() const;
+    qint64 bytesAvailable() const;
+    bool resize(qint64 sz);
+    bool flush();
 
-    int readInt();
-    uint readUint();
+    qint64 read(char* data, qint64 maxSize);
+    QByteArray read(qint64 maxSize);
+    QByteArray readAll();
+    int readInt(){
+        int value;
+        if (buffered()>=(int)sizeof(int)){
+            memcpy(&value,m_ReadBuffer.constData()+m_ReadPos,sizeof(int));
+            m_ReadPos+=sizeof(int);
+        }
+        else
+        if (read(reinterpret_cast<char*>(&value),sizeof(int))!=sizeof(int))
+            value = 0;
+        return value;
+    }
+    uint readUint(){return static_cast<uint>(readInt());}
+    //bulk decode, false if file has less than count values
+    bool readInts(qint32* values, int count);
+    bool readUints(quint32* values, int count);
     QString readString();
     QString readUtf8Line();
 
-    void writeInt(int value);
-    void writeUint(uint value);
+    qint64 write(const char* data, qint64 size);
+    qint64 write(const QByteArray& data){return write(data.constData(),data.size());}
+    void writeInt(int value){
+        if (!m_ReadBuffer.isEmpty())
+            dropReadBuffer();
+        if (m_WriteBuffer.size()+(int)sizeof(int)>BUFFER_SIZE)
+            flushWriteBuffer();
+        m_WriteBuffer.append(reinterpret_cast<const char*>(&value),sizeof(int));
+    }
+    void writeUint(uint value){writeInt(static_cast<int>(value));}
     void writeString(const QString& value);
 };
 
+//bounds checked reader over memory block(mapped file). reading outside block returns zeroes and sets overflow flag
+class cMemoryBin
+{
+protected:
+    const uchar*    m_Data;
+    qint64          m_Size;
+    qint64          m_Pos;
+    bool            m_Overflow;
+public:
+    cMemoryBin(const uchar* data, qint64 size):m_Data(data),m_Size(size),m_Pos(0),m_Overflow(false){}
+
+    qint64 pos(){return m_Pos;}
+    qint64 bytesAvailable(){return m_Size-m_Pos;}
+    bool isOverflow(){return m_Overflow;}
+
+    bool read(char* data, qint64 size){
+        if (size<0 || size>bytesAvailable()){
+            m_Overflow = true;
+            m_Pos = m_Size;
+            memset(data,0,size>0?size:0);
+            return false;
+        }
+        memcpy(data,m_Data+m_Pos,size);
+        m_Pos+=size;
+        return true;
+    }
+    int readInt(){int value; read(reinterpret_cast<char*>(&value),sizeof(int)); return value;}
+    uint readUint(){uint value; read(reinterpret_cast<char*>(&value),sizeof(uint)); return value;}
+    quint64 readVarUint();
+    qint64 readVarInt(){return unzigzag(readVarUint());}
+    static qint64 unzigzag(quint64 value){return static_cast<qint64>(value>>1)^-static_cast<qint64>(value&1);}
+    QString readString();
+    QString readVarString(); //varuint size + utf8
+};
+
+//writer into memory block, file parts are built here and written by one call
+class cByteBin
+{
+protected:
+    QByteArray      m_Data;
+public:
+    const QByteArray& data(){return m_Data;}
+    int size(){return m_Data.size();}
+    void reserve(int size){m_Data.reserve(size);}
+
+    void write(const char* data, int size){m_Data.append(data,size);}
+    void writeInt(int value){write(reinterpret_cast<char*>(&value),sizeof(int));}
+    void writeUint(uint value){write(reinterpret_cast<char*>(&value),sizeof(uint));}
+    //7 bits per byte, high bit marks continuation
+    void writeVarUint(quint64 value){
+        while (value>=0x80){
+            m_Data.append(static_cast<char>(value|0x80));
+            value>>=7;
+        }
+        m_Data.append(static_cast<char>(value));
+    }
+    void writeVarInt(qint64 value){writeVarUint(zigzag(value));}
+    //small negative values stay short
+    static quint64 zigzag(qint64 value){return (static_cast<quint64>(value)<<1)^static_cast<quint64>(value>>63);}
+    void writeVarString(const QString& value);
+};
+
 #endif // CFILEBIN_H
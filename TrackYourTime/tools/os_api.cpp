@@ -24,6 +24,8 @@
 #include <QCoreApplication>
 #include <QDir>
 #include <QThread>
+#include <QSysInfo>
+#include <QHash>
 
 QStringList readFileToStringList(const QString& FileName){
     QStringList stringList;
@@ -197,72 +199,340 @@ void removeAutorun()
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 #include <X11/Xutil.h>
+#include <X11/Xlib-xcb.h>
+#include <X11/extensions/XInput2.h>
+#include <xcb/xcb.h>
 
 QString getUserName()
 {
     return qgetenv("USER");
 }
 
-bool GetActiveWindowClassAndTitle(QString& windowClass,QString& windowTitle)
+static int ignoreXErrors(Display* display, XErrorEvent* error)
 {
-    Display *display	= XOpenDisplay(NULL);
-    if (!display)
-        return false;
-
-    Window root 	= DefaultRootWindow(display);
-    Atom active 	= XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
+    Q_UNUSED(display)
+    Q_UNUSED(error)
+    //window can be destroyed between notification and query. it's not fatal
+    return 0;
+}
 
-    XTextProperty text;
-    char **name = NULL;
-    int param;
+//connection for probes is opened once and kept for all application lifetime.
+//probes use xcb requests, their errors come with replies and don't reach Xlib error handler
+static Display* x11Display()
+{
+    static Display* display = NULL;
+    if (!display)
+        display = XOpenDisplay(NULL);
+    return display;
+}
 
+static Window getActiveWindow(Display* display, Atom netActiveWindow)
+{
+    Window result = 0;
     Atom type_ret;
     int format_ret;
     unsigned long items_ret;
     unsigned long after_ret;
     unsigned char *prop_data = 0;
+    if (XGetWindowProperty(display, DefaultRootWindow(display), netActiveWindow, 0, 1, False, XA_WINDOW,
+                           &type_ret, &format_ret, &items_ret, &after_ret, &prop_data) == Success && prop_data){
+        if (items_ret>0)
+            result = *(Window *)prop_data;
+        XFree(prop_data);
+    }
+    return result;
+}
 
-    bool success = false;
+struct sX11Atoms{
+    xcb_atom_t netActiveWindow;
+    xcb_atom_t netWmName;
+    xcb_atom_t netWmPid;
+    xcb_atom_t utf8String;
+};
 
-    if(XGetWindowProperty(display, root, active, 0, 0x7fffffff, False, XA_WINDOW,
-    &type_ret, &format_ret, &items_ret, &after_ret, &prop_data) == Success)
-    {
-        Window *active_window = (Window *)prop_data;
-        Atom wm_state = XInternAtom(display, "WM_CLASS", False);
-        XGetTextProperty(display, *active_window, &text, wm_state);
-        Xutf8TextPropertyToTextList(display, &text, &name, &param);        
-        if (name!=NULL){
-            success = true;
-            windowClass = *name;
-            XFree(name);
-
-            XTextProperty title;
-            char **Tname = NULL;
-            XGetTextProperty(display, *active_window, &title, XA_WM_NAME);
-            Xutf8TextPropertyToTextList(display, &title, &Tname, &param);
-            if (Tname!=NULL){
-                windowTitle=*Tname;
-                XFree(Tname);
-            }
+//atoms are requested once, all in one batch
+static const sX11Atoms* x11Atoms(xcb_connection_t* connection)
+{
+    static sX11Atoms atoms;
+    static bool initialized = false;
+    if (!initialized){
+        const char* names[] = {"_NET_ACTIVE_WINDOW", "_NET_WM_NAME", "_NET_WM_PID", "UTF8_STRING"};
+        xcb_atom_t* values[] = {&atoms.netActiveWindow, &atoms.netWmName, &atoms.netWmPid, &atoms.utf8String};
+        const int count = sizeof(names)/sizeof(names[0]);
+        xcb_intern_atom_cookie_t cookies[count];
+        for (int i = 0; i<count; i++)
+            cookies[i] = xcb_intern_atom(connection, 0, strlen(names[i]), names[i]);
+        for (int i = 0; i<count; i++){
+            xcb_intern_atom_reply_t* reply = xcb_intern_atom_reply(connection, cookies[i], NULL);
+            *values[i] = reply?reply->atom:XCB_ATOM_NONE;
+            free(reply);
+        }
+        initialized = true;
+    }
+    return &atoms;
+}
+
+static QByteArray getPropertyReply(xcb_connection_t* connection, xcb_get_property_cookie_t cookie, xcb_atom_t* type = NULL)
+{
+    QByteArray result;
+    xcb_generic_error_t* error = NULL;
+    xcb_get_property_reply_t* reply = xcb_get_property_reply(connection, cookie, &error);
+    if (reply){
+        result = QByteArray(static_cast<const char*>(xcb_get_property_value(reply)), xcb_get_property_value_length(reply));
+        if (type)
+            *type = reply->type;
+        free(reply);
+    }
+    free(error);
+    return result;
+}
+
+struct sWindowProperties{
+    QString windowClass;
+    QString title;
+    uint pid;
+    bool localClient;
+};
+
+//two round trips per probe: active window, then all its properties pipelined in one batch
+bool GetActiveWindowProperties(sWindowProperties& properties)
+{
+    Display *display	= x11Display();
+    if (!display)
+        return false;
+    xcb_connection_t* connection = XGetXCBConnection(display);
+    const sX11Atoms* atoms = x11Atoms(connection);
+
+    QByteArray activeWindow = getPropertyReply(connection, xcb_get_property(connection, 0, DefaultRootWindow(display), atoms->netActiveWindow, XCB_ATOM_WINDOW, 0, 1));
+    if (activeWindow.size()<(int)sizeof(xcb_window_t))
+        return false;
+    xcb_window_t window = *reinterpret_cast<const xcb_window_t*>(activeWindow.constData());
+    if (window==XCB_WINDOW_NONE)
+        return false;
+
+    xcb_get_property_cookie_t classCookie = xcb_get_property(connection, 0, window, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 0, 256);
+    xcb_get_property_cookie_t netNameCookie = xcb_get_property(connection, 0, window, atoms->netWmName, atoms->utf8String, 0, 1024);
+    xcb_get_property_cookie_t nameCookie = xcb_get_property(connection, 0, window, XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, 1024);
+    xcb_get_property_cookie_t pidCookie = xcb_get_property(connection, 0, window, atoms->netWmPid, XCB_ATOM_CARDINAL, 0, 1);
+    xcb_get_property_cookie_t machineCookie = xcb_get_property(connection, 0, window, XCB_ATOM_WM_CLIENT_MACHINE, XCB_ATOM_STRING, 0, 256);
+
+    //WM_CLASS is "instance\0class\0", instance name is used as application name
+    QByteArray windowClass = getPropertyReply(connection, classCookie);
+    QByteArray netName = getPropertyReply(connection, netNameCookie);
+    xcb_atom_t nameType = XCB_ATOM_NONE;
+    QByteArray name = getPropertyReply(connection, nameCookie, &nameType);
+    QByteArray pid = getPropertyReply(connection, pidCookie);
+    QByteArray machine = getPropertyReply(connection, machineCookie);
+
+    if (windowClass.isEmpty() && pid.isEmpty())
+        return false;
+    properties.windowClass = QString::fromLatin1(windowClass.constData(), qstrnlen(windowClass.constData(), windowClass.size()));
+    if (!netName.isEmpty())
+        properties.title = QString::fromUtf8(netName);
+    else
+    if (nameType==atoms->utf8String)
+        properties.title = QString::fromUtf8(name);
+    else
+    if (nameType==XCB_ATOM_STRING)
+        properties.title = QString::fromLatin1(name);
+    else
+        properties.title = QString::fromLocal8Bit(name);
+    properties.pid = pid.size()>=(int)sizeof(quint32)?*reinterpret_cast<const quint32*>(pid.constData()):0;
+    //pid of forwarded window belongs to other host
+    properties.localClient = machine.isEmpty() || QString::fromLatin1(machine.constData(), qstrnlen(machine.constData(), machine.size()))==QSysInfo::machineHostName();
+
+    return true;
+}
+
+cActiveWindowWatcher::cActiveWindowWatcher(QObject *parent) :
+    QObject(parent),
+    m_Display(NULL),
+    m_ActiveWindow(0),
+    m_NetActiveWindowAtom(0),
+    m_NetWmNameAtom(0),
+    m_XInputOpcode(-1),
+    m_UserInputWatched(false),
+    m_Notifier(NULL)
+{
+    //own connection, so events are not mixed with replies of probes
+    Display* display = XOpenDisplay(NULL);
+    if (!display){
+        qCritical() << "cActiveWindowWatcher: can't open display, active window will be polled";
+        return;
+    }
+    m_Display = display;
+    m_NetActiveWindowAtom = XInternAtom(display, "_NET_ACTIVE_WINDOW", False);
+    m_NetWmNameAtom = XInternAtom(display, "_NET_WM_NAME", False);
+
+    XSelectInput(display, DefaultRootWindow(display), PropertyChangeMask);
+    watchActiveWindow();
+
+    //raw input events of XInput 2 come for whole screen, they are used to wake up from idle
+    int event, error;
+    if (XQueryExtension(display, "XInputExtension", &m_XInputOpcode, &event, &error)){
+        int major = 2, minor = 0;
+        if (XIQueryVersion(display, &major, &minor)!=Success)
+            m_XInputOpcode = -1;
+    }
+    else
+        m_XInputOpcode = -1;
+    XFlush(display);
+
+    m_Notifier = new QSocketNotifier(ConnectionNumber(display),QSocketNotifier::Read,this);
+    connect(m_Notifier,SIGNAL(activated(int)),this,SLOT(processEvents()));
+}
+
+cActiveWindowWatcher::~cActiveWindowWatcher()
+{
+    delete m_Notifier;
+    if (m_Display)
+        XCloseDisplay(static_cast<Display*>(m_Display));
+}
+
+void cActiveWindowWatcher::watchActiveWindow()
+{
+    Display* display = static_cast<Display*>(m_Display);
+    Window window = getActiveWindow(display, m_NetActiveWindowAtom);
+    if (window==m_ActiveWindow)
+        return;
+    //errors are ignored only for these requests, handler is process wide and is restored after sync
+    XErrorHandler previousHandler = XSetErrorHandler(ignoreXErrors);
+    //title of previous window is not interesting anymore
+    if (m_ActiveWindow)
+        XSelectInput(display, m_ActiveWindow, NoEventMask);
+    m_ActiveWindow = window;
+    if (m_ActiveWindow)
+        XSelectInput(display, m_ActiveWindow, PropertyChangeMask);
+    XSync(display, False);
+    XSetErrorHandler(previousHandler);
+}
+
+void cActiveWindowWatcher::watchUserInput(bool enable)
+{
+    if (!canWatchUserInput() || m_UserInputWatched==enable)
+        return;
+    m_UserInputWatched = enable;
+    Display* display = static_cast<Display*>(m_Display);
+    unsigned char mask[XIMaskLen(XI_LASTEVENT)] = {0};
+    if (enable){
+        XISetMask(mask, XI_RawKeyPress);
+        XISetMask(mask, XI_RawButtonPress);
+        XISetMask(mask, XI_RawMotion);
+    }
+    XIEventMask eventMask;
+    eventMask.deviceid = XIAllMasterDevices;
+    eventMask.mask_len = sizeof(mask);
+    eventMask.mask = mask;
+    XISelectEvents(display, DefaultRootWindow(display), &eventMask, 1);
+    XFlush(display);
+}
+
+void cActiveWindowWatcher::processEvents()
+{
+    Display* display = static_cast<Display*>(m_Display);
+    bool changed = false;
+    bool input = false;
+    while (XPending(display)){
+        XEvent event;
+        XNextEvent(display, &event);
+        if (event.type==GenericEvent && event.xcookie.extension==m_XInputOpcode){
+            input = m_UserInputWatched;
+            continue;
+        }
+        if (event.type!=PropertyNotify)
+            continue;
+        const XPropertyEvent& property = event.xproperty;
+        if (property.window==DefaultRootWindow(display) && property.atom==m_NetActiveWindowAtom){
+            watchActiveWindow();
+            changed = true;
         }
+        else
+        if (property.window==m_ActiveWindow && (property.atom==m_NetWmNameAtom || property.atom==XA_WM_NAME))
+            changed = true;
+    }
+    XFlush(display);
+    if (changed)
+        emit activeWindowChanged();
+    if (input)
+        emit userInput();
+}
 
-    };
-    XCloseDisplay(display);
+struct sProcessInfo{
+    quint64 startTime;
+    QString path;
+    QString fileName;
+};
+
+static const int PROCESS_CACHE_SIZE = 256;
+
+//start time in clock ticks since boot, together with pid it identifies process. 0 if process is gone
+static quint64 getProcessStartTime(uint pid)
+{
+    QFile stat(QString("/proc/%1/stat").arg(pid));
+    if (!stat.open(QIODevice::ReadOnly))
+        return 0;
+    QByteArray data = stat.readAll();
+    //process name in brackets can contain spaces, so fields are counted after it. first field after name is 3rd, starttime is 22nd
+    int nameEnd = data.lastIndexOf(')');
+    if (nameEnd<0)
+        return 0;
+    QList<QByteArray> fields = data.mid(nameEnd+2).split(' ');
+    return fields.size()>19?fields[19].toULongLong():0;
+}
 
-    return success;
+//executable of process is resolved once per process, pid reuse is detected by start time
+static const sProcessInfo* getProcessInfo(uint pid)
+{
+    static QHash<uint,sProcessInfo> cache;
+
+    quint64 startTime = getProcessStartTime(pid);
+    if (startTime==0)
+        return NULL;
+    QHash<uint,sProcessInfo>::const_iterator it = cache.constFind(pid);
+    if (it!=cache.constEnd() && it->startTime==startTime)
+        return &it.value();
+
+    if (cache.size()>=PROCESS_CACHE_SIZE)
+        cache.clear();
+
+    QString executable = QFile::symLinkTarget(QString("/proc/%1/exe").arg(pid));
+    if (executable.isEmpty()){
+        //exe link of other user's process is not readable, cmdline is
+        QFile cmdline(QString("/proc/%1/cmdline").arg(pid));
+        if (cmdline.open(QIODevice::ReadOnly)){
+            QByteArray data = cmdline.read(4096);
+            executable = QString::fromLocal8Bit(data.constData(), qstrnlen(data.constData(), data.size()));
+        }
+    }
+    //binary replaced by update while process is running
+    if (executable.endsWith(" (deleted)"))
+        executable.chop(10);
+
+    sProcessInfo info;
+    info.startTime = startTime;
+    QFileInfo fileInfo(executable);
+    info.fileName = fileInfo.fileName().simplified();
+    info.path = fileInfo.isAbsolute()?fileInfo.absolutePath().simplified():"";
+    return &cache.insert(pid,info).value();
 }
 
 sSysInfo getCurrentApplication()
 {
-    //TODO - now i can't get current window executable and use window class. but it's sucks.
     sSysInfo fileInfo;
     fileInfo.fileName = "";
     fileInfo.path = "";
-    QString windowClass;
-    QString windowTitle;
-    if (GetActiveWindowClassAndTitle(windowClass,windowTitle)){
-        fileInfo.fileName = windowClass.simplified();
-        fileInfo.title = windowTitle.simplified();
+    sWindowProperties properties;
+    if (GetActiveWindowProperties(properties)){
+        fileInfo.fileName = properties.windowClass.simplified();
+        fileInfo.title = properties.title.simplified();
+        const sProcessInfo* process = properties.pid && properties.localClient?getProcessInfo(properties.pid):NULL;
+        if (process){
+            fileInfo.path = process->path;
+            //window class stays application name - existing db and predefined scripts are bound to it.
+            //executable names windows without class
+            if (fileInfo.fileName.isEmpty())
+                fileInfo.fileName = process->fileName;
+        }
     }
 
     return fileInfo;
@@ -463,18 +733,11 @@ int getIdleTime()
 #include <X11/extensions/scrnsaver.h>
 
 int getIdleTime() {
-        time_t idle_time;
-        static XScreenSaverInfo *mit_info;
-        Display *display;
-        int screen;
-        mit_info = XScreenSaverAllocInfo();
-        if((display=XOpenDisplay(NULL)) == NULL) { return(-1); }
-        screen = DefaultScreen(display);
-        XScreenSaverQueryInfo(display, RootWindow(display,screen), mit_info);
-        idle_time = (mit_info->idle) / 1000;
-        XFree(mit_info);
-        XCloseDisplay(display);
-        return idle_time;
+        static XScreenSaverInfo *mit_info = XScreenSaverAllocInfo();
+        Display *display = x11Display();
+        if (display == NULL || mit_info == NULL) { return(-1); }
+        XScreenSaverQueryInfo(display, DefaultRootWindow(display), mit_info);
+        return (mit_info->idle) / 1000;
 }
 #endif
 
@@ -486,3 +749,34 @@ int getIdleTime() {
     return timeSinceLastEvent;
 }
 #endif
+
+#ifndef Q_OS_LINUX
+cActiveWindowWatcher::cActiveWindowWatcher(QObject *parent) :
+    QObject(parent),
+    m_Display(NULL),
+    m_ActiveWindow(0),
+    m_NetActiveWindowAtom(0),
+    m_NetWmNameAtom(0),
+    m_XInputOpcode(-1),
+    m_UserInputWatched(false),
+    m_Notifier(NULL)
+{
+}
+
+cActiveWindowWatcher::~cActiveWindowWatcher()
+{
+}
+
+void cActiveWindowWatcher::watchActiveWindow()
+{
+}
+
+void cActiveWindowWatcher::watchUserInput(bool enable)
+{
+    Q_UNUSED(enable)
+}
+
+void cActiveWindowWatcher::processEvents()
+{
+}
+#endif
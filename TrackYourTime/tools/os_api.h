@@ -21,12 +21,15 @@
 
 #include <QString>
 #include <QPoint>
+#include <QObject>
+#include <QSocketNotifier>
 
 struct sSysInfo{
     QString path;
     QString fileName;
     QString title;
 };
+Q_DECLARE_METATYPE(sSysInfo)
 
 sSysInfo getCurrentApplication();
 
@@ -36,5 +39,35 @@ void setAutorun();
 void removeAutorun();
 int getIdleTime();
 
+//reports focus and title changes of active window as they happen, and on request first user input.
+//on platforms without such notifications it's inactive and application must be polled
+class cActiveWindowWatcher : public QObject
+{
+    Q_OBJECT
+protected:
+    void*               m_Display;
+    unsigned long       m_ActiveWindow;
+    unsigned long       m_NetActiveWindowAtom;
+    unsigned long       m_NetWmNameAtom;
+    int                 m_XInputOpcode;
+    bool                m_UserInputWatched;
+    QSocketNotifier*    m_Notifier;
+
+    void watchActiveWindow();
+public:
+    explicit cActiveWindowWatcher(QObject *parent = 0);
+    ~cActiveWindowWatcher();
+
+    bool isActive(){return m_Display!=NULL;}
+    bool canWatchUserInput(){return m_XInputOpcode>=0;}
+    //userInput() is emitted on every key, button or pointer move while enabled
+    void watchUserInput(bool enable);
+signals:
+    void activeWindowChanged();
+    void userInput();
+private slots:
+    void processEvents();
+};
+
 #endif // OS_API
 
@@ -29,6 +29,7 @@ App_SettingsWindow::App_SettingsWindow(cDataManager *DataManager) :
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 3, 0))
     ui->plainTextEditScript->setPlaceholderText("Place title parser code here. Look predefined scripts for example.");
+    ui->plainTextEditRules->setPlaceholderText("glob:* - Mozilla Firefox => $1");
 #endif
     connect(ui->pushButtonApply,SIGNAL(released()),this,SLOT(onApply()));
     connect(ui->pushButtonStartDebug,SIGNAL(released()),this,SLOT(onSetDebug()));
@@ -41,10 +42,7 @@ App_SettingsWindow::~App_SettingsWindow()
 
 void App_SettingsWindow::onApply()
 {
-    sAppInfo* appInfo = m_DataManager->applications(m_AppIndex);
-    appInfo->trackerType = (sAppInfo::eTrackerType)ui->comboBoxTrackingType->currentIndex();
-    appInfo->useCustomScript = ui->checkBoxCustomScript->isChecked();
-    appInfo->customScript = ui->plainTextEditScript->toPlainText();
+    m_DataManager->setApplicationSettings(m_AppIndex,(sAppInfo::eTrackerType)ui->comboBoxTrackingType->currentIndex(),ui->checkBoxCustomScript->isChecked(),ui->plainTextEditScript->toPlainText(),ui->plainTextEditRules->toPlainText());
     m_DataManager->setDebugScript("");
     hide();
 }
@@ -65,6 +63,7 @@ void App_SettingsWindow::onScriptResult(QString value, const sSysInfo &data, QSt
 void App_SettingsWindow::showApp(int appIndex)
 {
     m_AppIndex = appIndex;
+    QReadLocker locker(m_DataManager->dataLock());
     const sAppInfo* appInfo = m_DataManager->applications(m_AppIndex);
     ui->labelApplication->setText(appInfo->activities[0].name);
     ui->comboBoxTrackingType->setCurrentIndex(appInfo->trackerType);
@@ -73,7 +72,9 @@ void App_SettingsWindow::showApp(int appIndex)
     if (script.isEmpty())
         script = "function parseData(appName, appTitle, trackingResult, currentOS){\n  return trackingResult;\n}";
     ui->plainTextEditScript->setPlainText(script);
+    ui->plainTextEditRules->setPlainText(appInfo->rules);
     ui->labelAdditionalInfo->setText(appInfo->predefinedInfo->info());
+    locker.unlock();
     showNormal();
     raise();
     activateWindow();
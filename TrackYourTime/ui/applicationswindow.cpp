@@ -23,6 +23,7 @@
 
 void ApplicationsWindow::rebuildProfilesList()
 {
+    QReadLocker locker(m_DataManager->dataLock());
     m_LoadingData = true;
     ui->comboBoxProfiles->clear();
     for (int i = 0; i<m_DataManager->profilesCount(); i++){
@@ -49,6 +50,9 @@ QTreeWidgetItem* createTreeItemCategory(int index, QColor color, const QString&
 
 void ApplicationsWindow::rebuildApplicationsList()
 {
+    //tree is filled under data lock, edits must not be sent back to data manager meanwhile
+    QReadLocker locker(m_DataManager->dataLock());
+    m_LoadingData = true;
     rebuildContextMenu();
     m_CategoriesExpandedState.resize(ui->treeWidgetApplications->topLevelItemCount());
     for (int i = 0; i<m_CategoriesExpandedState.size(); i++){
@@ -164,10 +168,12 @@ void ApplicationsWindow::rebuildApplicationsList()
     if (categories.size()+1<m_CategoriesExpandedState.size())
         uncategorized->setExpanded(categories.size()+1);
     ui->treeWidgetApplications->verticalScrollBar()->setValue(m_ScrollPos);
+    m_LoadingData = false;
 }
 
 void ApplicationsWindow::rebuildContextMenu()
 {
+    QReadLocker locker(m_DataManager->dataLock());
     m_MoveToMenu.clear();
     for (int i = 0; i<m_DataManager->categoriesCount(); i++)
         m_MoveToMenu.addAction(m_DataManager->categories(i)->name)->setData(i);
@@ -244,6 +250,8 @@ void ApplicationsWindow::onApplicationsChange()
 void ApplicationsWindow::onCategoryChanged(QTreeWidgetItem *item, int column)
 {
     Q_UNUSED(column)
+    if (m_LoadingData)
+        return;
     if (item->type()==cApplicationsTreeWidget::TREE_ITEM_TYPE_CATEGORY){
         int categoryIndex = item->data(0,Qt::UserRole).toInt();
         if (categoryIndex>-1)
@@ -267,6 +275,7 @@ void ApplicationsWindow::onContextMenu(const QPoint &pos)
                 canEditItem = true;
         if (item->type()==cApplicationsTreeWidget::TREE_ITEM_TYPE_APPLICATION_ACTIVITY){
             canMoveToCategory = true;
+            QReadLocker locker(m_DataManager->dataLock());
             const sAppInfo* app = m_DataManager->applications(item->data(0,Qt::UserRole).toInt());
             if (app->activities[item->data(0,Qt::UserRole+1).toInt()].categories[m_DataManager->getCurrentProfileIndex()].visible)
                 canHideItem = true;
@@ -307,10 +316,10 @@ void ApplicationsWindow::onMenuSelection(QAction *menuAction)
         for (int i = 0; i<items.size(); i++){
             QTreeWidgetItem* item = items[i];
             if (item->type()==cApplicationsTreeWidget::TREE_ITEM_TYPE_APPLICATION_ACTIVITY){
-                sAppInfo* app = m_DataManager->applications(item->data(0,Qt::UserRole).toInt());
+                int appIndex = item->data(0,Qt::UserRole).toInt();
                 int activityIndex = item->data(0,Qt::UserRole+1).toInt();
                 if (activityIndex>-1)
-                    app->activities[activityIndex].categories[m_DataManager->getCurrentProfileIndex()].visible = true;
+                    m_DataManager->setApplicationActivityVisible(m_DataManager->getCurrentProfileIndex(),appIndex,activityIndex,true);
             }
         }
     }
@@ -320,10 +329,10 @@ void ApplicationsWindow::onMenuSelection(QAction *menuAction)
         for (int i = 0; i<items.size(); i++){
             QTreeWidgetItem* item = items[i];
             if (item->type()==cApplicationsTreeWidget::TREE_ITEM_TYPE_APPLICATION_ACTIVITY){
-                sAppInfo* app = m_DataManager->applications(item->data(0,Qt::UserRole).toInt());
+                int appIndex = item->data(0,Qt::UserRole).toInt();
                 int activityIndex = item->data(0,Qt::UserRole+1).toInt();
                 if (activityIndex>-1){
-                    app->activities[activityIndex].categories[m_DataManager->getCurrentProfileIndex()].visible = false;
+                    m_DataManager->setApplicationActivityVisible(m_DataManager->getCurrentProfileIndex(),appIndex,activityIndex,false);
                     if (!ui->checkBoxShowHidden->isChecked())
                         itemsToDelete.push_back(item);
                 }
@@ -366,7 +375,10 @@ void ApplicationsWindow::onMenuSelection(QAction *menuAction)
             if (item->type()==cApplicationsTreeWidget::TREE_ITEM_TYPE_CATEGORY){
                 int index = item->data(0,Qt::UserRole).toInt();
                 if (index>-1){
-                    QColor newColor = QColorDialog::getColor(m_DataManager->categories(index)->color);
+                    m_DataManager->dataLock()->lockForRead();
+                    QColor oldColor = m_DataManager->categories(index)->color;
+                    m_DataManager->dataLock()->unlock();
+                    QColor newColor = QColorDialog::getColor(oldColor);
                     if (newColor.isValid()){
                         m_DataManager->setCategoryColor(index,newColor);
                         QPixmap pixmap(16,16);
@@ -387,9 +399,9 @@ void ApplicationsWindow::onMoveToMenuSelection(QAction *menuAction)
     for (int i = 0; i<items.size(); i++){
         QTreeWidgetItem* item = items[i];
         if (item->type()==cApplicationsTreeWidget::TREE_ITEM_TYPE_APPLICATION_ACTIVITY){
-            sAppInfo* app = m_DataManager->applications(item->data(0,Qt::UserRole).toInt());
+            int appIndex = item->data(0,Qt::UserRole).toInt();
             int activityIndex = item->data(0,Qt::UserRole+1).toInt();
-            app->activities[activityIndex].categories[m_DataManager->getCurrentProfileIndex()].category = menuAction->data().toInt();
+            m_DataManager->setApplicationActivityCategory(m_DataManager->getCurrentProfileIndex(),appIndex,activityIndex,menuAction->data().toInt());
         }
     }
     onDelayedRebuild();
@@ -25,6 +25,7 @@
 
 void cTrayIcon::rebuildMenu()
 {
+    QReadLocker locker(m_DataManager->dataLock());
     m_ProfilesMenu.clear();
     for (int i = 0; i<m_DataManager->profilesCount(); i++){
         QAction* profile = m_ProfilesMenu.addAction(m_DataManager->profiles(i)->name);
@@ -95,7 +95,7 @@ void NotificationWindow::stop()
 void NotificationWindow::onButtonSetCurrent()
 {
     if (m_AppIndex>-1){
-        m_DataManager->applications(m_AppIndex)->activities[m_ActivityIndex].categories[m_DataManager->getCurrentProfileIndex()].category = ui->comboBoxCategory->currentIndex();
+        m_DataManager->setApplicationActivityCategory(m_DataManager->getCurrentProfileIndex(),m_AppIndex,m_ActivityIndex,ui->comboBoxCategory->currentIndex());
     }
     stop();
 }
@@ -103,8 +103,7 @@ void NotificationWindow::onButtonSetCurrent()
 void NotificationWindow::onButtonSetAll()
 {
     if (m_AppIndex>-1){
-        for (int i = 0; i<m_DataManager->profilesCount(); i++)
-            m_DataManager->applications(m_AppIndex)->activities[m_ActivityIndex].categories[i].category = ui->comboBoxCategory->currentIndex();
+        m_DataManager->setApplicationActivityCategory(-1,m_AppIndex,m_ActivityIndex,ui->comboBoxCategory->currentIndex());
     }
     stop();
 }
@@ -175,6 +174,8 @@ void NotificationWindow::onShow()
     if (m_ClosingInterrupted && isVisible())
         return;
 
+    //current activity and model are changed by tracking thread
+    QReadLocker locker(m_DataManager->dataLock());
     bool needResetTimer = !m_Timer.isActive();
     bool canShow = isVisible();
     switch(m_VisibilityBehavior){
@@ -22,9 +22,16 @@
 
 void ProfilesWindow::rebuild()
 {
+    //names are copied, list edits are sent to data manager and can't be made under data lock
+    QStringList names;
+    m_DataManager->dataLock()->lockForRead();
+    for (int i = 0; i<m_DataManager->profilesCount(); i++)
+        names.push_back(m_DataManager->profiles(i)->name);
+    m_DataManager->dataLock()->unlock();
+
     ui->listWidgetProfiles->clear();
-    for (int i = 0; i<m_DataManager->profilesCount(); i++){
-        QListWidgetItem* item = new QListWidgetItem(m_DataManager->profiles(i)->name);
+    for (int i = 0; i<names.size(); i++){
+        QListWidgetItem* item = new QListWidgetItem(names[i]);
         item->setData(Qt::UserRole,i);
         item->setFlags(Qt::ItemIsEditable | Qt::ItemIsUserCheckable | Qt::ItemIsEnabled);
         item->setCheckState(Qt::Unchecked);
@@ -99,7 +106,10 @@ void ProfilesWindow::onMenuSelection(QAction *menuAction)
             return;
         }
         int index = checkedItems[0];
-        m_DataManager->addNewProfile(m_DataManager->profiles(index)->name+" "+tr("copy"),index);
+        m_DataManager->dataLock()->lockForRead();
+        QString name = m_DataManager->profiles(index)->name;
+        m_DataManager->dataLock()->unlock();
+        m_DataManager->addNewProfile(name+" "+tr("copy"),index);
         rebuild();
         return;
     }
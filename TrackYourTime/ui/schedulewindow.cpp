@@ -17,6 +17,7 @@
  */
 #include "schedulewindow.h"
 #include "ui_schedulewindow.h"
+#include <QDateTime>
 
 ScheduleWindow::ScheduleWindow(cDataManager *dataManager, cSchedule *schedule) :
     QMainWindow(0),
@@ -42,6 +43,7 @@ void ScheduleWindow::rebuild()
         ui->comboBoxAction->addItem(cScheduleItem::getActionName((cScheduleItem::eScheduleAction)i),i);
     ui->comboBoxAction->setCurrentIndex(0);
 
+    QReadLocker locker(m_DataManager->dataLock());
     ui->comboBoxProfiles->clear();
     for (int i = 0; i<m_DataManager->profilesCount(); i++)
         ui->comboBoxProfiles->addItem(m_DataManager->profiles(i)->name,i);
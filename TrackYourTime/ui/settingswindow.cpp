@@ -31,6 +31,8 @@ void SettingsWindow::loadPreferences()
 
     int IdleDelay = settings.db()->value(cDataManager::CONF_IDLE_DELAY_ID,cDataManager::DEFAULT_SECONDS_IDLE_DELAY).toInt();
     int AutoSaveDelay = settings.db()->value(cDataManager::CONF_AUTOSAVE_DELAY_ID,cDataManager::DEFAULT_SECONDS_AUTOSAVE_DELAY).toInt();    
+    int ScriptTimeBudget = settings.db()->value(cDataManager::CONF_SCRIPT_TIME_BUDGET_ID,cDataManager::DEFAULT_SCRIPT_TIME_BUDGET_MS).toInt();
+    int TrackersBuffer = settings.db()->value(cDataManager::CONF_TRACKERS_BUFFER_ID,cDataManager::DEFAULT_TRACKERS_BUFFER_KB).toInt();
     bool Autorun = settings.db()->value(cDataManager::CONF_AUTORUN_ID,true).toBool();
     QString StorageFileName = settings.db()->value(cDataManager::CONF_STORAGE_FILENAME_ID,m_DataManager->getStorageFileName()).toString();
     QString Language = QLocale::system().name();
@@ -38,6 +40,7 @@ void SettingsWindow::loadPreferences()
     Language = settings.db()->value(cDataManager::CONF_LANGUAGE_ID,Language).toString();
     bool ClientMode = settings.db()->value(cDataManager::CONF_CLIENT_MODE_ID,false).toBool();
     QString ClientModeHost = settings.db()->value(cDataManager::CONF_CLIENT_MODE_HOST_ID,"").toString();
+    bool ClientModeBinary = settings.db()->value(cDataManager::CONF_CLIENT_MODE_BINARY_ID,false).toBool();
     QString NotificationMessage = settings.db()->value(cDataManager::CONF_NOTIFICATION_MESSAGE_ID,getDefaultMessage()).toString();
     m_NotifPos = settings.db()->value(cDataManager::CONF_NOTIFICATION_POSITION_ID,QPoint(10,10)).toPoint();
     m_NotifSize = settings.db()->value(cDataManager::CONF_NOTIFICATION_SIZE_ID,QPoint(250,100)).toPoint();
@@ -56,6 +59,8 @@ void SettingsWindow::loadPreferences()
 
     ui->checkBoxClientMode->setChecked(ClientMode);
     ui->lineEditClientModeHost->setText(ClientModeHost);
+    ui->checkBoxClientModeBinary->setChecked(ClientModeBinary);
+    ui->spinBoxTrackersBuffer->setValue(TrackersBuffer);
 
     ui->lineEditBackupFolder->setText(BackupFileName);
     ui->comboBoxBackupDelay->setCurrentIndex(BackupDelay);
@@ -78,6 +83,7 @@ void SettingsWindow::loadPreferences()
         }
     ui->spinBoxIdleDelay->setValue(IdleDelay);
     ui->spinBoxAutosaveDelay->setValue(AutoSaveDelay);
+    ui->spinBoxScriptTimeBudget->setValue(ScriptTimeBudget);
     ui->lineEditStorageFileName->setText(StorageFileName);
     ui->checkBoxAutorun->setChecked(Autorun);
 
@@ -89,9 +95,12 @@ void SettingsWindow::applyPreferences()
 
     settings.db()->setValue(cDataManager::CONF_IDLE_DELAY_ID,ui->spinBoxIdleDelay->value());
     settings.db()->setValue(cDataManager::CONF_AUTOSAVE_DELAY_ID,ui->spinBoxAutosaveDelay->value());
+    settings.db()->setValue(cDataManager::CONF_SCRIPT_TIME_BUDGET_ID,ui->spinBoxScriptTimeBudget->value());
     settings.db()->setValue(cDataManager::CONF_STORAGE_FILENAME_ID,ui->lineEditStorageFileName->text().trimmed());
     settings.db()->setValue(cDataManager::CONF_CLIENT_MODE_ID,ui->checkBoxClientMode->isChecked());
     settings.db()->setValue(cDataManager::CONF_CLIENT_MODE_HOST_ID,ui->lineEditClientModeHost->text());
+    settings.db()->setValue(cDataManager::CONF_CLIENT_MODE_BINARY_ID,ui->checkBoxClientModeBinary->isChecked());
+    settings.db()->setValue(cDataManager::CONF_TRACKERS_BUFFER_ID,ui->spinBoxTrackersBuffer->value());
     settings.db()->setValue(cDataManager::CONF_NOTIFICATION_MESSAGE_ID,ui->lineEditNotif_Message->text());
     settings.db()->setValue(cDataManager::CONF_NOTIFICATION_POSITION_ID,m_NotifPos);
     settings.db()->setValue(cDataManager::CONF_NOTIFICATION_SIZE_ID,m_NotifSize);
@@ -37,8 +37,8 @@ bool lessThan( const sStatisticItem & e1, const sStatisticItem & e2 )
 
 void StatisticWindow::rebuild(QDate from, QDate to)
 {
-    QDateTime statStart = from.startOfDay();
-    QDateTime statEnd = to.addDays(1).startOfDay();
+    //containers and query snapshot must see the same model
+    QReadLocker locker(m_DataManager->dataLock());
 
     //prepare containers
     m_Uncategorized.TotalTime = 0;
@@ -60,45 +60,62 @@ void StatisticWindow::rebuild(QDate from, QDate to)
         m_Applications[i].NormalValue = 0;
         m_Applications[i].Name = app->activities[0].name;
         m_Applications[i].Color = Qt::white;
+        m_Applications[i].item = NULL;
         m_Applications[i].childs.resize(app->activities.size());
         for (int j = 0; j<m_Applications[i].childs.size(); j++){
             m_Applications[i].childs[j].TotalTime = 0;
             m_Applications[i].childs[j].NormalValue = 0;
             m_Applications[i].childs[j].Name = app->activities[j].name;
             m_Applications[i].childs[j].Color = Qt::white;
+            m_Applications[i].childs[j].item = NULL;
         }
     }
-
-    //calculation
     m_TotalTime = 0;
-    for (int i = 0; i<m_Applications.size(); i++){
-        const sAppInfo* app = m_DataManager->applications(i);
-        for (int activity = 0; activity<app->activities.size(); activity++){
-            const sActivityInfo* ainfo = &app->activities[activity];
-            for (int j = ainfo->periods.size()-1; j>=0; --j){
-                QDateTime start = ainfo->periods[j].start;
-                QDateTime end = ainfo->periods[j].start.addSecs(ainfo->periods[j].length);
-                if (end>statStart && start<statEnd){
-                    if (start<statStart)
-                        start = statStart;
-                    if (end>statEnd)
-                        end = statEnd;
-                    int duration = start.secsTo(end);
-                    m_TotalTime+=duration;
-                    m_Applications[i].TotalTime+=duration;
-                    m_Applications[i].childs[activity].TotalTime+=duration;
-                    int cat = ainfo->categories[ainfo->periods[j].profileIndex].category;
-                    if (cat==-1)
-                        m_Uncategorized.TotalTime+=duration;
-                    else
-                        m_Categories[cat].TotalTime+=duration;
-                }
-                if (end<statStart)
-                    break;
-            }
-        }
+    ui->treeWidgetApplications->clear();
+
+    //calculation is done by worker over snapshot, tracking is never blocked by report
+    m_FastUpdateAvailable = false;
+    m_PendingUpdates.clear();
+    m_QueryIncludesToday = to>=QDate::currentDate() && from<=QDate::currentDate();
+    m_SnapshotSequence = m_DataManager->statisticSequence();
+    m_QueryId = m_Engine.start(cStatisticEngine::makeQuery(m_DataManager,from.toJulianDay(),to.toJulianDay()));
+}
+
+void StatisticWindow::applyResult(const sStatisticResult &result)
+{
+    m_TotalTime = result.totalTime;
+    m_Uncategorized.TotalTime = result.uncategorized;
+    for (int i = 0; i<m_Categories.size() && i<result.categories.size(); i++)
+        m_Categories[i].TotalTime = result.categories[i];
+    for (int i = 0; i<m_Applications.size() && i<result.applications.size(); i++){
+        m_Applications[i].TotalTime = result.applications[i];
+        const QVector<int>& activities = result.activities[i];
+        for (int j = 0; j<m_Applications[i].childs.size() && j<activities.size(); j++)
+            m_Applications[i].childs[j].TotalTime = activities[j];
     }
+}
+
+bool StatisticWindow::addTime(int application, int activity, int category, int secondsCount)
+{
+    if (application<0 || application>=m_Applications.size())
+        return false;
+    if (activity<0 || activity>=m_Applications[application].childs.size())
+        return false;
+    if (category>=m_Categories.size())
+        return false;
 
+    m_TotalTime+=secondsCount;
+    m_Applications[application].TotalTime+=secondsCount;
+    m_Applications[application].childs[activity].TotalTime+=secondsCount;
+    if (category==-1)
+        m_Uncategorized.TotalTime+=secondsCount;
+    else
+        m_Categories[category].TotalTime+=secondsCount;
+    return true;
+}
+
+void StatisticWindow::updateTotals()
+{
     calcNormalizedValues();
 
     //qSort( m_Categories.begin(), m_Categories.end(), lessThan ); disable sorting, fast update need direct access to elements.
@@ -107,9 +124,10 @@ void StatisticWindow::rebuild(QDate from, QDate to)
     ui->widgetDiagram->update();
 
     ui->labelTotalTime->setText(DurationToString(m_TotalTime));
+}
 
-
-    //fill applications widget
+void StatisticWindow::fillApplications()
+{
     ui->treeWidgetApplications->setSortingEnabled(false);
     ui->treeWidgetApplications->clear();
     for (int i = 0; i<m_Applications.size(); i++){
@@ -146,7 +164,34 @@ void StatisticWindow::rebuild(QDate from, QDate to)
         }
     }
     ui->treeWidgetApplications->setSortingEnabled(true);
+}
+
+void StatisticWindow::onStatisticProgress(int id, sStatisticResult result)
+{
+    if (id!=m_QueryId)
+        return;
+    applyResult(result);
+    updateTotals();
+}
+
+void StatisticWindow::onStatisticFinished(int id, sStatisticResult result)
+{
+    if (id!=m_QueryId)
+        return;
+    m_QueryId = 0;
+    applyResult(result);
+    //seconds tracked after snapshot was taken
+    for (int i = 0; i<m_PendingUpdates.size(); i++){
+        const sPendingStatisticUpdate& update = m_PendingUpdates[i];
+        addTime(update.application,update.activity,update.category,update.secondsCount);
+    }
+    m_PendingUpdates.clear();
+    updateTotals();
+    fillApplications();
     m_FastUpdateAvailable = true;
+
+    ui->pushButtonExportApplicationsCSV->setEnabled(true);
+    ui->pushButtonExportCategoriesCSV->setEnabled(true);
 }
 
 void StatisticWindow::calcNormalizedValues()
@@ -215,9 +260,11 @@ int StatisticWindow::getTodayCategoryTime(int category)
 
 bool StatisticWindow::isTodayStatisticAvailable()
 {
+    if (m_QueryId!=0)
+        return false;
     if (!isVisible())
         return true;
-    if (ui->dateEditTo->date()==QDateTime::currentDateTime().date() && ui->dateEditTo->date()==QDateTime::currentDateTime().date())
+    if (ui->dateEditTo->date()==QDate::currentDate() && ui->dateEditTo->date()==QDate::currentDate())
         return true;
     return false;
 }
@@ -238,38 +285,39 @@ void StatisticWindow::onExportApplicationsCSVPress()
 void StatisticWindow::showAndUpdate()
 {
     showNormal();
-    if (ui->dateEditTo->date()==QDateTime::currentDateTime().date())
+    if (ui->dateEditTo->date()==QDate::currentDate())
         onUpdatePress();
 }
 
-void StatisticWindow::fastUpdate(int application, int activity, int category, int secondsCount, bool fullUpdate)
+void StatisticWindow::fastUpdate(int application, int activity, int category, int secondsCount, bool fullUpdate, int sequence)
 {
+    QReadLocker locker(m_DataManager->dataLock());
+    //update was queued before snapshot and is already counted by query
+    if (!fullUpdate && sequence<=m_SnapshotSequence)
+        return;
+    if (m_QueryId!=0 && !fullUpdate){
+        //report is being calculated from snapshot, keep seconds tracked after it
+        if (m_QueryIncludesToday){
+            sPendingStatisticUpdate update = {application, activity, category, secondsCount};
+            m_PendingUpdates.push_back(update);
+        }
+        return;
+    }
     if (!isVisible()){
         bool needFullBackgroundUpdate = !m_FastUpdateAvailable;
         if (m_Categories.size()!=m_DataManager->categoriesCount() || m_Applications.size()!=m_DataManager->applicationsCount()){
             needFullBackgroundUpdate = true;
         }
-        if (ui->dateEditFrom->date()!=QDateTime::currentDateTime().date() || ui->dateEditTo->date()!=QDateTime::currentDateTime().date()){
+        if (ui->dateEditFrom->date()!=QDate::currentDate() || ui->dateEditTo->date()!=QDate::currentDate()){
             needFullBackgroundUpdate = true;
         }
         if (needFullBackgroundUpdate){
-            ui->dateEditFrom->setDate(QDateTime::currentDateTime().date());
-            ui->dateEditTo->setDate(QDateTime::currentDateTime().date());
+            ui->dateEditFrom->setDate(QDate::currentDate());
+            ui->dateEditTo->setDate(QDate::currentDate());
             onUpdatePress();
         }
         else{
-            if (application>=m_Applications.size())
-                return;
-            if (activity>=m_Applications[application].childs.size())
-                return;
-
-            m_TotalTime+=secondsCount;
-            m_Applications[application].TotalTime+=secondsCount;
-            m_Applications[application].childs[activity].TotalTime+=secondsCount;
-            if (category==-1)
-                m_Uncategorized.TotalTime+=secondsCount;
-            else
-                m_Categories[category].TotalTime+=secondsCount;
+            addTime(application,activity,category,secondsCount);
         }
         return;
     }
@@ -279,7 +327,7 @@ void StatisticWindow::fastUpdate(int application, int activity, int category, in
     }
     if (!m_FastUpdateAvailable)
         return;
-    if (ui->dateEditTo->date()!=QDateTime::currentDateTime().date())
+    if (ui->dateEditTo->date()!=QDate::currentDate())
         return;
 
     if (m_Categories.size()!=m_DataManager->categoriesCount() || m_Applications.size()!=m_DataManager->applicationsCount()){
@@ -287,18 +335,8 @@ void StatisticWindow::fastUpdate(int application, int activity, int category, in
         return;
     }
 
-    if (application>=m_Applications.size())
+    if (!addTime(application,activity,category,secondsCount))
         return;
-    if (activity>=m_Applications[application].childs.size())
-        return;
-
-    m_TotalTime+=secondsCount;
-    m_Applications[application].TotalTime+=secondsCount;
-    m_Applications[application].childs[activity].TotalTime+=secondsCount;
-    if (category==-1)
-        m_Uncategorized.TotalTime+=secondsCount;
-    else
-        m_Categories[category].TotalTime+=secondsCount;
     calcNormalizedValues();
 
     if (m_Applications[application].item==NULL || m_Applications[application].childs[activity].item==NULL){
@@ -349,6 +387,9 @@ void StatisticWindow::onExportCategoriesCSVPress()
 StatisticWindow::StatisticWindow(cDataManager *DataManager) :
     QMainWindow(0),    
     m_FastUpdateAvailable(false),
+    m_QueryId(0),
+    m_QueryIncludesToday(false),
+    m_SnapshotSequence(0),
     ui(new Ui::StatisticWindow)
 {
     ui->setupUi(this);
@@ -370,6 +411,8 @@ StatisticWindow::StatisticWindow(cDataManager *DataManager) :
     connect(ui->pushButtonUpdate, SIGNAL(released()), this, SLOT(onUpdatePress()));
     connect(ui->pushButtonExportApplicationsCSV, SIGNAL(released()), this, SLOT(onExportApplicationsCSVPress()));
     connect(ui->pushButtonExportCategoriesCSV, SIGNAL(released()), this, SLOT(onExportCategoriesCSVPress()));
+    connect(&m_Engine, SIGNAL(progress(int,sStatisticResult)), this, SLOT(onStatisticProgress(int,sStatisticResult)));
+    connect(&m_Engine, SIGNAL(finished(int,sStatisticResult)), this, SLOT(onStatisticFinished(int,sStatisticResult)));
 
     ui->pushButtonExportApplicationsCSV->setEnabled(false);
     ui->pushButtonExportCategoriesCSV->setEnabled(false);
@@ -425,9 +468,9 @@ void StatisticWindow::onSetPeriodPress()
 
 void StatisticWindow::onUpdatePress()
 {
+    ui->pushButtonExportApplicationsCSV->setEnabled(false);
+    ui->pushButtonExportCategoriesCSV->setEnabled(false);
     rebuild(ui->dateEditFrom->date(),ui->dateEditTo->date());
-    ui->pushButtonExportApplicationsCSV->setEnabled(true);
-    ui->pushButtonExportCategoriesCSV->setEnabled(true);
 }
 
 
@@ -23,9 +23,11 @@
 #include <QVector>
 #include <QString>
 #include <QColor>
+#include <QDate>
 #include <QPaintEvent>
 #include <QTreeWidgetItem>
 #include "../data/cdatamanager.h"
+#include "../data/cstatisticengine.h"
 #include "../tools/tools.h"
 
 namespace Ui {
@@ -41,6 +43,13 @@ struct sStatisticItem{
     QVector<sStatisticItem> childs;
 };
 
+struct sPendingStatisticUpdate{
+    int application;
+    int activity;
+    int category;
+    int secondsCount;
+};
+
 class cStatisticDiagramWidget: public QWidget
 {
     Q_OBJECT
@@ -63,11 +72,20 @@ protected:
     bool                    m_FastUpdateAvailable;
     int                     m_TotalTime;
     cDataManager*           m_DataManager;
+    cStatisticEngine        m_Engine;
+    int                     m_QueryId;
+    bool                    m_QueryIncludesToday;
+    int                     m_SnapshotSequence; //last fast update included in snapshot of running query
+    QVector<sPendingStatisticUpdate> m_PendingUpdates;
 
     sStatisticItem          m_Uncategorized;
     QVector<sStatisticItem> m_Categories;
     QVector<sStatisticItem> m_Applications;
     void rebuild(QDate from, QDate to);
+    void applyResult(const sStatisticResult& result);
+    bool addTime(int application, int activity, int category, int secondsCount);
+    void updateTotals();
+    void fillApplications();
     void calcNormalizedValues();
     void saveToCSV(const QVector<sStatisticItem*> &items,  const QString& FileName);
 public:
@@ -91,7 +109,10 @@ public slots:
 
     void showAndUpdate();
 
-    void fastUpdate(int application, int activity, int category, int secondsCount, bool fullUpdate);
+    void fastUpdate(int application, int activity, int category, int secondsCount, bool fullUpdate, int sequence);
+private slots:
+    void onStatisticProgress(int id, sStatisticResult result);
+    void onStatisticFinished(int id, sStatisticResult result);
 };
 
 #endif // STATISTICWINDOW_H